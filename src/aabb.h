@@ -36,6 +36,7 @@ public:
     }
 
     bool hit(const ray& r, interval ray_t) const {
+        STAT_COUNT(aabb_tests);
         for (int i = 0; i < 3; ++i) {
             double invD = 1 / r.direction()[i];
             double orig = r.origin()[i];
@@ -95,4 +96,16 @@ aabb operator*(double scale, const aabb& bbox) {
     return bbox * scale;
 }
 
+aabb overlap(const aabb& a, const aabb& b) {
+    // The box common to a and b, or an empty box if they do not meet. Unlike the constructors,
+    // this never pads, so the result stays inside both boxes.
+    aabb common;
+    common.x = interval(fmax(a.x.min, b.x.min), fmin(a.x.max, b.x.max));
+    common.y = interval(fmax(a.y.min, b.y.min), fmin(a.y.max, b.y.max));
+    common.z = interval(fmax(a.z.min, b.z.min), fmin(a.z.max, b.z.max));
+    if (common.x.size() < 0 || common.y.size() < 0 || common.z.size() < 0)
+        return aabb::empty;
+    return common;
+}
+
 #endif // AABB_H
\ No newline at end of file
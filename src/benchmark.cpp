@@ -0,0 +1,293 @@
+// Scene benchmark: renders registered scenes at a fixed seed and reduced sample count, and prints
+// load time, BVH build time, render time, rays traced, Mrays/s and peak memory as JSON on stdout.
+// Progress goes to stderr and nothing is displayed, so it runs headless and its output can be
+// saved and compared between commits. Running the same scenes with each --split shows the trade-off
+// between BVH build time and trace time of the builders: bvh_build_seconds times the BVH over the
+// scene's objects, and mesh_bvh_build_seconds the models' own mesh BVHs, built while the scene
+// loads (so also counted in load_seconds). Models load from their mesh caches, BVH included, when
+// present (written by the first run), so run twice, or pass --no-mesh-cache, to time a cold load
+// or to compare builders on model scenes;
+// --assimp imports OBJ files through Assimp instead of the parallel OBJ reader, and
+// --no-mesh-preprocess keeps imported meshes as the file has them (no welding or reordering), and
+// --mesh-storage stores model meshes with float or 16-bit quantized positions to save memory.
+// With --frames, animated scenes render a sequence: before each frame the BVH is refit, and rebuilt
+// once its SAH cost exceeds --refit-threshold times its cost when built (0 rebuilds every frame).
+//
+// Usage: RayTracingBenchmark [--scene NAME]... [--width N] [--spp N] [--seed N] [--threads N]
+//                            [--split median|sah|lbvh|hlbvh|sbvh] [--leaf-size N] [--bins N] [--traversal-cost X]
+//                            [--build-threads N] [--morton-bits 30|63] [--bvh-width 2|4|8] [--sbvh-growth X]
+//                            [--frames N] [--refit-threshold X] [--no-mesh-cache] [--assimp] [--no-mesh-preprocess]
+//                            [--mesh-storage full|float|unorm16] [--resources DIR] [--output-dir DIR] [--list]
+
+#include "rtweekend.h"
+
+#include "scenes.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+struct benchmark_options {
+    std::vector<std::string> scenes; // Scenes to run (empty runs all)
+    int image_width = 200;
+    int samples_per_pixel = 16;
+    uint64_t seed = 1;
+    int num_threads = 0;
+    int frames = 1; // Frames rendered of animated scenes
+    double refit_threshold = bvh_refit_max_cost_growth; // 0 rebuilds the BVH every frame
+    std::string resource_dir = "../../resources";
+    std::string output_dir; // If set, each rendered image is written here as <scene>.pfm
+    bvh_build_options bvh;
+};
+
+struct benchmark_scene {
+    std::string name;
+    std::function<scene(const benchmark_options&)> build;
+};
+
+static std::vector<benchmark_scene> registered_scenes() {
+    return {
+        { "cornellbox_bunny", [](const benchmark_options& o) { return cornellbox_bunny(o.resource_dir); } },
+        { "multi_light", [](const benchmark_options& o) { return multi_light(o.resource_dir); } },
+        { "sphere_field_10k", [](const benchmark_options&) { return sphere_field(10000); } },
+        { "triangle_terrain_20k", [](const benchmark_options&) { return triangle_terrain(20000); } },
+        { "bunny_instances_1000", [](const benchmark_options& o) { return bunny_instances(o.resource_dir, 1000); } },
+    };
+}
+
+static const char* split_name(bvh_split_method split) {
+    switch (split) {
+        case bvh_split_method::median: return "median";
+        case bvh_split_method::lbvh: return "lbvh";
+        case bvh_split_method::hlbvh: return "hlbvh";
+        case bvh_split_method::sbvh: return "sbvh";
+        default: return "sah";
+    }
+}
+
+static bool parse_split(const std::string& name, bvh_split_method& split) {
+    // False, leaving split as it is, if no split method has this name.
+    for (bvh_split_method method : { bvh_split_method::median, bvh_split_method::sah, bvh_split_method::lbvh,
+                                     bvh_split_method::hlbvh, bvh_split_method::sbvh }) {
+        if (name == split_name(method)) {
+            split = method;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_mesh_storage(const std::string& name, mesh_storage& storage) {
+    // False, leaving storage as it is, if no storage has this name.
+    if (name == "full") storage = mesh_storage::full;
+    else if (name == "float") storage = mesh_storage::float32;
+    else if (name == "unorm16") storage = mesh_storage::unorm16;
+    else return false;
+    return true;
+}
+
+static double peak_rss_mb() {
+    // Peak resident set size of the process so far.
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    return 0.0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0.0;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes
+#else
+    return usage.ru_maxrss / 1024.0; // Kilobytes
+#endif
+#endif
+}
+
+template <typename Body>
+static double time_seconds(const Body& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void run_scene(const benchmark_scene& bench, const benchmark_options& options, bool first, std::ostream& out) {
+    std::clog << "Benchmark " << bench.name << '\n';
+
+    scene s;
+    model::preprocess_totals = mesh_preprocess_stats();
+    model::bvh_build_seconds_total = 0.0;
+    double load_seconds = time_seconds([&] { s = bench.build(options); });
+    const mesh_preprocess_stats& meshes = model::preprocess_totals;
+    size_t object_count = s.world.objects.size();
+
+    std::shared_ptr<bvh_node> bvh;
+    double build_seconds = time_seconds([&] { bvh = std::make_shared<bvh_node>(s.world, options.bvh); });
+    s.world = hittable_list(bvh);
+
+    s.cam.image_width = options.image_width;
+    s.cam.samples_per_pixel = options.samples_per_pixel;
+    s.cam.seed = options.seed;
+    s.cam.num_threads = options.num_threads;
+    s.cam.write_image = !options.output_dir.empty();
+    if (s.cam.write_image)
+        s.cam.output_file = options.output_dir + "/" + bench.name + ".pfm";
+
+    double render_seconds = 0.0, refit_seconds = 0.0;
+    long long rays = 0;
+    int frames = s.animate ? std::max(options.frames, 1) : 1;
+    int rebuilds = 0;
+    for (int frame = 0; frame < frames; ++frame) {
+        if (frames > 1) {
+            s.animate(frame);
+            refit_seconds += time_seconds([&] {
+                if (options.refit_threshold <= 0) {
+                    bvh->rebuild();
+                    ++rebuilds;
+                } else if (bvh->refit(options.refit_threshold)) {
+                    ++rebuilds;
+                }
+            });
+        }
+        render_seconds += time_seconds([&] { s.cam.render(s.world, s.lights); });
+        rays += s.cam.rays_traced();
+    }
+
+    const film& image = s.cam.rendered_image();
+    double mean_luminance = 0.0;
+    for (int p = 0; p < image.pixel_count(); ++p)
+        mean_luminance += luminance(image.pixel(p));
+    mean_luminance /= std::max(image.pixel_count(), 1);
+
+    double mrays_per_second = (render_seconds > 0) ? rays / render_seconds / 1e6 : 0.0;
+
+    out << (first ? "" : ",\n")
+        << "    {\n"
+        << "      \"scene\": \"" << bench.name << "\",\n"
+        << "      \"objects\": " << object_count << ",\n"
+        << "      \"width\": " << image.width() << ",\n"
+        << "      \"height\": " << image.height() << ",\n"
+        << "      \"samples_per_pixel\": " << options.samples_per_pixel << ",\n"
+        << "      \"seed\": " << options.seed << ",\n"
+        << "      \"frames\": " << frames << ",\n"
+        << "      \"bvh_split\": \"" << split_name(options.bvh.split) << "\",\n"
+        << "      \"bvh_width\": " << options.bvh.width << ",\n"
+        << std::fixed << std::setprecision(6)
+        << "      \"load_seconds\": " << load_seconds << ",\n"
+        << "      \"mesh_vertices_before\": " << meshes.vertices_before << ",\n"
+        << "      \"mesh_vertices_after\": " << meshes.vertices_after << ",\n"
+        << "      \"mesh_triangles_before\": " << meshes.triangles_before << ",\n"
+        << "      \"mesh_triangles_after\": " << meshes.triangles_after << ",\n"
+        << "      \"mesh_mb_before\": " << meshes.bytes_before / 1e6 << ",\n"
+        << "      \"mesh_mb_after\": " << meshes.bytes_after / 1e6 << ",\n"
+        << "      \"mesh_bvh_build_seconds\": " << model::bvh_build_seconds_total << ",\n"
+        << "      \"bvh_build_seconds\": " << build_seconds << ",\n"
+        << "      \"bvh_build_threads\": " << (options.bvh.build_threads > 0 ? options.bvh.build_threads : hardware_threads()) << ",\n"
+        << "      \"bvh_sah_cost\": " << bvh->quality().sah_cost << ",\n"
+        << "      \"bvh_depth\": " << bvh->quality().depth << ",\n"
+        << "      \"bvh_nodes\": " << bvh->quality().node_count << ",\n"
+        << "      \"bvh_duplication\": " << bvh->quality().duplication << ",\n"
+        << "      \"bvh_refit_seconds\": " << refit_seconds << ",\n"
+        << "      \"bvh_rebuilds\": " << rebuilds << ",\n"
+        << "      \"render_seconds\": " << render_seconds << ",\n"
+        << "      \"build_and_render_seconds\": " << build_seconds + refit_seconds + render_seconds << ",\n"
+        << "      \"rays_traced\": " << rays << ",\n"
+        << "      \"mrays_per_second\": " << mrays_per_second << ",\n"
+        << "      \"peak_rss_mb\": " << peak_rss_mb() << ",\n"
+        << "      \"mean_luminance\": " << mean_luminance << "\n"
+        << "    }";
+    out.unsetf(std::ios::floatfield);
+}
+
+int main(int argc, char** argv) {
+    benchmark_options options;
+    std::vector<benchmark_scene> scenes = registered_scenes();
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        bool has_value = a + 1 < argc;
+        if (arg == "--list") {
+            for (const auto& bench : scenes)
+                std::cout << bench.name << '\n';
+            return 0;
+        } else if (arg == "--scene" && has_value) {
+            options.scenes.push_back(argv[++a]);
+        } else if (arg == "--width" && has_value) {
+            options.image_width = std::atoi(argv[++a]);
+        } else if (arg == "--spp" && has_value) {
+            options.samples_per_pixel = std::atoi(argv[++a]);
+        } else if (arg == "--seed" && has_value) {
+            options.seed = std::strtoull(argv[++a], nullptr, 10);
+        } else if (arg == "--threads" && has_value) {
+            options.num_threads = std::atoi(argv[++a]);
+        } else if (arg == "--split" && has_value && parse_split(argv[a + 1], options.bvh.split)) {
+            ++a;
+        } else if (arg == "--leaf-size" && has_value) {
+            options.bvh.max_leaf_size = std::atoi(argv[++a]);
+        } else if (arg == "--bins" && has_value) {
+            options.bvh.sah_bins = std::atoi(argv[++a]);
+        } else if (arg == "--traversal-cost" && has_value) {
+            options.bvh.traversal_cost = std::atof(argv[++a]);
+        } else if (arg == "--build-threads" && has_value) {
+            options.bvh.build_threads = std::atoi(argv[++a]);
+        } else if (arg == "--bvh-width" && has_value) {
+            options.bvh.width = std::atoi(argv[++a]);
+        } else if (arg == "--sbvh-growth" && has_value) {
+            options.bvh.sbvh_max_growth = std::atof(argv[++a]);
+        } else if (arg == "--morton-bits" && has_value) {
+            options.bvh.morton_bits = std::atoi(argv[++a]);
+        } else if (arg == "--frames" && has_value) {
+            options.frames = std::atoi(argv[++a]);
+        } else if (arg == "--refit-threshold" && has_value) {
+            options.refit_threshold = std::atof(argv[++a]);
+        } else if (arg == "--no-mesh-cache") {
+            model::use_cache = false;
+        } else if (arg == "--assimp") {
+            model::use_obj_reader = false;
+        } else if (arg == "--no-mesh-preprocess") {
+            model::preprocess_meshes = false;
+        } else if (arg == "--mesh-storage" && has_value && parse_mesh_storage(argv[a + 1], model::default_mesh_storage)) {
+            ++a;
+        } else if (arg == "--resources" && has_value) {
+            options.resource_dir = argv[++a];
+        } else if (arg == "--output-dir" && has_value) {
+            options.output_dir = argv[++a];
+        } else {
+            std::cerr << "Unknown or incomplete option '" << arg << "'\n";
+            return 1;
+        }
+    }
+
+    std::vector<const benchmark_scene*> selected;
+    for (const auto& bench : scenes) {
+        bool wanted = options.scenes.empty();
+        for (const auto& name : options.scenes)
+            wanted = wanted || name == bench.name;
+        if (wanted)
+            selected.push_back(&bench);
+    }
+    if (selected.empty()) {
+        std::cerr << "No matching scenes; use --list to see them\n";
+        return 1;
+    }
+    model::default_bvh_options = options.bvh; // Model meshes get their own BVH, built the same way
+
+    std::cout << "{\n  \"threads\": " << (options.num_threads > 0 ? options.num_threads : hardware_threads())
+              << ",\n  \"results\": [\n";
+    for (size_t k = 0; k < selected.size(); ++k)
+        run_scene(*selected[k], options, k == 0, std::cout);
+    std::cout << "\n  ]\n}\n";
+}
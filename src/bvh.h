@@ -2,85 +2,455 @@
 #define BVH_H
 
 #include <algorithm>
+#include <cstdint>
+#include <vector>
 
 #include "rtweekend.h"
 
+#include "bvh_build.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "lbvh_build.h"
+#include "mapped_file.h"
+#include "sbvh_build.h"
+#include "wide_bvh.h"
 
-class bvh_node : public hittable {
+inline bvh_build_result build_bvh(const std::vector<aabb>& bounds, const bvh_build_options& options,
+                                  const bvh_clip_function& clip = nullptr) {
+    // Builds a BVH over the boxes with the method chosen in the options. Spatial splits clip
+    // primitives with `clip` if given, and otherwise only their boxes.
+    if (options.split == bvh_split_method::lbvh || options.split == bvh_split_method::hlbvh)
+        return lbvh_builder(bounds, options).build();
+    if (options.split == bvh_split_method::sbvh)
+        return sbvh_builder(bounds, options, clip).build();
+    return bvh_builder(bounds, options).build();
+}
+
+struct alignas(32) linear_bvh_node {
+    // One node of a flattened BVH. The bounds are floats rounded outward, so a node never misses a
+    // ray that its double precision box would hit. The first child of an interior node directly
+    // follows it in the node array.
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset; // Interior: index of the second child. Leaf: first entry of the primitive order
+    uint16_t count; // Primitives in a leaf, 0 for interior nodes
+    uint16_t axis; // Split axis of an interior node
+
+    bool is_leaf() const { return count > 0; }
+
+    aabb box() const {
+        return aabb(interval(bounds_min[0], bounds_max[0]), interval(bounds_min[1], bounds_max[1]),
+                    interval(bounds_min[2], bounds_max[2]));
+    }
+
+    void set_box(const aabb& b) {
+        for (int a = 0; a < 3; ++a) {
+            bounds_min[a] = round_down_to_float(b.axis(a).min);
+            bounds_max[a] = round_up_to_float(b.axis(a).max);
+        }
+    }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+class linear_bvh {
   public:
-    bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
+    // A BVH flattened into one depth-first array of nodes, traversed with an explicit stack. It
+    // only knows primitives by their index in `order`; the caller tests the primitives of a leaf
+    // through a callback, so the same traversal serves any kind of primitive storage.
+    shared_array<linear_bvh_node> nodes; // Root at index 0
+    shared_array<int> order; // Primitive indices in leaf order; leaves refer to ranges of it
+    int depth = 0; // Longest root-to-leaf path, which bounds the traversal stack
 
-    bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
-        // Build the bounding box of the span of source objects.
-        bbox = aabb::empty;
-        for (int object_index=start; object_index < end; object_index++)
-            bbox = aabb(bbox, src_objects[object_index]->bounding_box());
+    linear_bvh() {}
+
+    explicit linear_bvh(const bvh_build_result& tree) : order(tree.order), depth(tree.quality.depth) {
+        std::vector<linear_bvh_node> flat;
+        flat.reserve(tree.nodes.size());
+        if (!tree.nodes.empty())
+            flatten(flat, tree, 0);
+        nodes = std::move(flat);
+    }
+
+    linear_bvh(shared_array<linear_bvh_node> nodes, shared_array<int> order, int depth)
+        : nodes(std::move(nodes)), order(std::move(order)), depth(depth) {}
+
+    void refit(const std::vector<aabb>& boxes) {
+        // Recomputes every node's box from boxes[k], the current bounds of the primitive at
+        // order[k], keeping the topology. Children follow their parent, so a reverse pass sees
+        // them first. The nodes are copied, so a tree mapped from a cache is left untouched.
+        std::vector<linear_bvh_node> updated = nodes.to_vector();
+        for (int i = static_cast<int>(updated.size()) - 1; i >= 0; --i) {
+            linear_bvh_node& node = updated[i];
+            aabb box = aabb::empty;
+            if (node.is_leaf()) {
+                for (int k = 0; k < node.count; ++k)
+                    box = aabb(box, boxes[node.offset + k]);
+            } else {
+                box = aabb(updated[i + 1].box(), updated[node.offset].box());
+            }
+            node.set_box(box);
+        }
+        nodes = std::move(updated);
+    }
+
+    double sah_cost(double traversal_cost) const {
+        // Expected cost of a ray that hits the root, as measure_bvh computes it, over the
+        // flattened bounds.
+        if (nodes.empty())
+            return 0.0;
+        double root_area = fmax(surface_area(nodes[0].box()), 1e-300);
+        double cost = 0.0;
+        for (const linear_bvh_node& node : nodes)
+            cost += surface_area(node.box()) * (node.is_leaf() ? node.count : traversal_cost);
+        return cost / root_area;
+    }
+
+    template <typename Visit>
+    void for_each_leaf(Visit&& visit) const {
+        // Calls visit(first, count) for every leaf, in node order.
+        for (const linear_bvh_node& node : nodes)
+            if (node.is_leaf())
+                visit(static_cast<int>(node.offset), static_cast<int>(node.count));
+    }
+
+    template <typename LeafHit>
+    bool intersect(const ray& r, interval ray_t, hit_record& rec, LeafHit&& leaf_hit, int start = 0) const {
+        // Closest hit below node `start`. Visits the child on the ray's near side of the split
+        // plane first, so later subtrees are culled by the shorter ray. leaf_hit(r, first, count,
+        // ray_t, rec) tests order[first, first + count) and lowers ray_t.max to any hit it records.
+        if (nodes.empty())
+            return false;
+
+        const double origin[3] = { r.origin().x(), r.origin().y(), r.origin().z() };
+        const double inv_dir[3] = { 1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z() };
+        const bool dir_is_neg[3] = { inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0 };
 
-        int axis = bbox.longest_axis();
+        int local_stack[stack_capacity];
+        std::vector<int> heap_stack;
+        int* stack = local_stack;
+        if (depth > stack_capacity) {
+            heap_stack.resize(depth);
+            stack = heap_stack.data();
+        }
+
+        bool hit_anything = false;
+        int top = 0;
+        int index = start;
+        while (true) {
+            STAT_COUNT(bvh_node_visits);
+            const linear_bvh_node& node = nodes[index];
+            if (hit_node(node, origin, inv_dir, ray_t)) {
+                if (node.is_leaf()) {
+                    if (leaf_hit(r, static_cast<int>(node.offset), static_cast<int>(node.count), ray_t, rec))
+                        hit_anything = true;
+                } else if (dir_is_neg[node.axis]) {
+                    stack[top++] = index + 1;
+                    index = static_cast<int>(node.offset);
+                    continue;
+                } else {
+                    stack[top++] = static_cast<int>(node.offset);
+                    index = index + 1;
+                    continue;
+                }
+            }
+            if (top == 0)
+                break;
+            index = stack[--top];
+        }
+        return hit_anything;
+    }
 
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                                      : box_z_compare;
+    template <typename LeafHit, typename LeafPacket>
+    void intersect_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits,
+                          LeafHit&& leaf_hit, LeafPacket&& leaf_packet) const {
+        // If the first active lane enters a node, the whole packet descends without testing the
+        // other lanes (coherent packets usually agree). Otherwise the packet is culled with one
+        // interval test where possible, and only then is every lane slab-tested at once. Once few
+        // lanes remain, the packet no longer pays off and those rays continue one at a time through
+        // the node's subtree. leaf_packet(first, count, mask) tests a leaf for the lanes in mask.
+        struct entry {
+            int index;
+            uint32_t mask;
+        };
 
-        auto objects = src_objects; // A modifiable array of the source scene objects
+        if (nodes.empty() || active == 0)
+            return;
 
-        size_t object_span = end - start;
+        entry local_stack[stack_capacity];
+        std::vector<entry> heap_stack;
+        entry* stack = local_stack;
+        if (depth > stack_capacity) {
+            heap_stack.resize(depth);
+            stack = heap_stack.data();
+        }
+
+        int top = 0;
+        stack[top++] = { 0, active };
+        while (top > 0) {
+            entry e = stack[--top];
+            STAT_COUNT(packet_node_visits);
+            const linear_bvh_node& node = nodes[e.index];
+            aabb box = node.box();
+
+            uint32_t mask = e.mask;
+            int first = 0;
+            while (first < packet_size && !(e.mask & (1u << first)))
+                ++first;
+            if (first == packet_size)
+                continue;
+
+            if (!packet_lane_hits_box(packet, first, box, t_min, hits.t[first])) {
+                double t_max = -infinity;
+                for (int l = 0; l < packet_size; ++l)
+                    if (e.mask & (1u << l)) t_max = fmax(t_max, hits.t[l]);
+                if (packet.frustum_misses(box, t_min, t_max))
+                    continue;
+
+                mask = packet_box_mask(packet, box, t_min, hits.t, e.mask);
+                if (mask == 0)
+                    continue;
+            }
+
+            if (lane_count(mask) <= packet_fallback_lanes) {
+                for (int l = 0; l < packet_size; ++l) {
+                    if (!(mask & (1u << l))) continue;
+                    hit_record rec;
+                    if (intersect(packet.lane_ray(l), interval(t_min, hits.t[l]), rec, leaf_hit, e.index))
+                        hits.record(l, rec);
+                }
+                continue;
+            }
+
+            if (node.is_leaf()) {
+                leaf_packet(static_cast<int>(node.offset), static_cast<int>(node.count), mask);
+                continue;
+            }
 
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            if (comparator(objects[start], objects[start+1])) {
-                left = objects[start];
-                right = objects[start+1];
+            const double* d = (node.axis == 0) ? packet.dx : (node.axis == 1) ? packet.dy : packet.dz;
+            if (d[first] < 0) {
+                stack[top++] = { e.index + 1, mask };
+                stack[top++] = { static_cast<int>(node.offset), mask };
             } else {
-                left = objects[start+1];
-                right = objects[start];
+                stack[top++] = { static_cast<int>(node.offset), mask };
+                stack[top++] = { e.index + 1, mask };
             }
+        }
+    }
+
+  private:
+    static const int stack_capacity = 64; // Deeper trees fall back to a heap allocated stack
+
+    static int flatten(std::vector<linear_bvh_node>& out, const bvh_build_result& tree, int index) {
+        // Appends node `index` of the built tree and its subtree depth first; returns its position.
+        const bvh_build_node& source = tree.nodes[index];
+        int position = static_cast<int>(out.size());
+        out.emplace_back();
+        out[position].set_box(source.bbox);
+        out[position].axis = static_cast<uint16_t>(source.axis);
+        if (source.count > 0) {
+            out[position].offset = static_cast<uint32_t>(source.first);
+            out[position].count = static_cast<uint16_t>(source.count);
         } else {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
+            out[position].count = 0;
+            flatten(out, tree, source.left);
+            out[position].offset = static_cast<uint32_t>(flatten(out, tree, source.right));
+        }
+        return position;
+    }
 
-            auto mid = start + object_span/2;
-            left = std::make_shared<bvh_node>(objects, start, mid);
-            right = std::make_shared<bvh_node>(objects, mid, end);
+    static bool hit_node(const linear_bvh_node& node, const double* origin, const double* inv_dir, interval ray_t) {
+        // Slab test against the node box with a precomputed inverse direction, as in aabb::hit.
+        STAT_COUNT(aabb_tests);
+        for (int a = 0; a < 3; ++a) {
+            double t0 = (node.bounds_min[a] - origin[a]) * inv_dir[a];
+            double t1 = (node.bounds_max[a] - origin[a]) * inv_dir[a];
+            if (inv_dir[a] < 0)
+                std::swap(t0, t1);
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+            if (ray_t.max <= ray_t.min)
+                return false;
         }
+        return true;
     }
+};
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        if (!bbox.hit(r, ray_t))
-            return false;
+struct bvh_layout {
+    // A built BVH in the traversal layout its width selects, ready to traverse or to cache.
+    int width = 4; // Children per node: 2 uses `binary`, 4 and 8 the collapsed layouts
+    aabb bbox; // Exact bounds of the root
+    bvh_quality quality; // Statistics of the built binary tree
+    linear_bvh binary;
+    wide_bvh<4> wide4;
+    wide_bvh<8> wide8;
 
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+    bvh_layout() {}
 
-        return hit_left || hit_right;
+    bvh_layout(const bvh_build_result& tree, int requested_width) {
+        width = (requested_width >= 8) ? 8 : (requested_width >= 4) ? 4 : 2;
+        bbox = tree.nodes.empty() ? aabb::empty : tree.nodes[0].bbox;
+        quality = tree.quality;
+        if (width == 8)
+            wide8 = wide_bvh<8>(tree);
+        else if (width == 4)
+            wide4 = wide_bvh<4>(tree);
+        else
+            binary = linear_bvh(tree);
     }
 
-    aabb bounding_box() const override { return bbox; }
+    const shared_array<int>& order() const {
+        return (width == 8) ? wide8.order : (width == 4) ? wide4.order : binary.order;
+    }
 
-  private:
-    std::shared_ptr<hittable> left;
-    std::shared_ptr<hittable> right;
-    aabb bbox;
+    void refit(const std::vector<aabb>& boxes) {
+        // Updates the bounds for boxes[k], the current bounds of the primitive at order()[k].
+        if (width == 8)
+            wide8.refit(boxes);
+        else if (width == 4)
+            wide4.refit(boxes);
+        else
+            binary.refit(boxes);
+        bbox = aabb::empty;
+        for (const aabb& box : boxes)
+            bbox = aabb(bbox, box);
+    }
 
-    static bool box_compare(
-        const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b, int axis_index
-    ) {
-        return a->bounding_box().axis(axis_index).min < b->bounding_box().axis(axis_index).min;
+    double sah_cost(double traversal_cost) const {
+        // SAH cost of the traversal layout, which unlike quality.sah_cost follows refits.
+        return (width == 8) ? wide8.sah_cost(traversal_cost)
+             : (width == 4) ? wide4.sah_cost(traversal_cost)
+             : binary.sah_cost(traversal_cost);
     }
 
-    static bool box_x_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
-        return box_compare(a, b, 0);
+    template <typename Visit>
+    void for_each_leaf(Visit&& visit) const {
+        if (width == 8)
+            wide8.for_each_leaf(visit);
+        else if (width == 4)
+            wide4.for_each_leaf(visit);
+        else
+            binary.for_each_leaf(visit);
     }
 
-    static bool box_y_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
-        return box_compare(a, b, 1);
+    template <typename LeafHit, typename LeafPacket>
+    void intersect_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits,
+                          LeafHit&& leaf_hit, LeafPacket&& leaf_packet) const {
+        if (width == 8)
+            wide8.intersect_packet(packet, active, t_min, hits, leaf_hit, leaf_packet);
+        else if (width == 4)
+            wide4.intersect_packet(packet, active, t_min, hits, leaf_hit, leaf_packet);
+        else
+            binary.intersect_packet(packet, active, t_min, hits, leaf_hit, leaf_packet);
     }
+};
+
+inline bvh_layout build_bvh_layout(const hittable_list& list, const bvh_build_options& options) {
+    std::vector<aabb> bounds;
+    bounds.reserve(list.objects.size());
+    for (const auto& object : list.objects)
+        bounds.push_back(object->bounding_box());
+    auto clip = [&list](int p, const aabb& box) { return list.objects[p]->clipped_bounding_box(box); };
+    return bvh_layout(build_bvh(bounds, options, clip), options.width);
+}
 
-    static bool box_z_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
-        return box_compare(a, b, 2);
+const double bvh_refit_max_cost_growth = 1.5; // Default SAH cost growth at which a refit rebuilds instead
+
+class bvh_node : public hittable {
+  public:
+    bvh_node(const hittable_list& list, const bvh_build_options& options = bvh_build_options())
+        : bvh_node(list, build_bvh_layout(list, options), options) {}
+
+    bvh_node(const hittable_list& list, bvh_layout built, const bvh_build_options& options = bvh_build_options())
+        : options(options) {
+        // Takes an already built layout over `list`, e.g. one read from a cache. The options are
+        // those a rebuild uses.
+        this->options.width = built.width;
+        adopt(list, std::move(built));
     }
+
+    const bvh_quality& quality() const { return tree.quality; } // Statistics of the tree built by this node
+    const bvh_layout& layout() const { return tree; }
+
+    bool refit(double max_cost_growth = bvh_refit_max_cost_growth) {
+        // Call after objects of the tree have moved or changed shape. Recomputes the bounds of
+        // every node from the objects' current bounding boxes, keeping the topology: far cheaper
+        // than a build, but the tree degrades as objects drift from where it was built. When the
+        // SAH cost of the refitted layout exceeds max_cost_growth times its cost after the last
+        // build, the tree is rebuilt instead. Returns true if it was rebuilt. Not safe to call
+        // while the tree is being traversed. Objects split by an SBVH refit to their whole
+        // bounds, which stays correct but loosens their nodes.
+        std::vector<aabb> boxes(objects.size());
+        for (size_t k = 0; k < objects.size(); ++k)
+            boxes[k] = objects[k]->bounding_box();
+        tree.refit(boxes);
+        if (tree.sah_cost(options.traversal_cost) <= max_cost_growth * built_cost)
+            return false;
+        rebuild();
+        return true;
+    }
+
+    void rebuild() {
+        // Builds the tree again over the same objects from their current bounds.
+        hittable_list list;
+        const shared_array<int>& order = tree.order();
+        for (size_t k = 0; k < objects.size(); ++k) {
+            if (list.objects.size() <= static_cast<size_t>(order[k]))
+                list.objects.resize(order[k] + 1);
+            list.objects[order[k]] = objects[k];
+        }
+        adopt(list, build_bvh_layout(list, options));
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (tree.width == 8)
+            return tree.wide8.intersect(r, ray_t, rec, object_leaf{ this });
+        if (tree.width == 4)
+            return tree.wide4.intersect(r, ray_t, rec, object_leaf{ this });
+        return tree.binary.intersect(r, ray_t, rec, object_leaf{ this });
+    }
+
+    void hit_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const override {
+        tree.intersect_packet(packet, active, t_min, hits, object_leaf{ this },
+            [&](int first, int count, uint32_t mask) {
+                for (int k = first; k < first + count; ++k)
+                    objects[k]->hit_packet(packet, mask, t_min, hits);
+            });
+    }
+
+    aabb bounding_box() const override { return tree.bbox; }
+
+  private:
+    bvh_layout tree;
+    std::vector<std::shared_ptr<hittable>> objects; // In leaf order
+    bvh_build_options options;
+    double built_cost = 0.0; // SAH cost of the layout after the last build
+
+    void adopt(const hittable_list& list, bvh_layout built) {
+        // Stores the objects in leaf order, so a leaf's objects are contiguous.
+        tree = std::move(built);
+        objects.clear();
+        objects.reserve(tree.order().size());
+        for (int index : tree.order())
+            objects.push_back(list.objects[index]);
+        built_cost = tree.sah_cost(options.traversal_cost);
+    }
+
+    struct object_leaf {
+        // Scalar leaf test for the traversals: the closest hit among a leaf's objects.
+        const bvh_node* self;
+
+        bool operator()(const ray& r, int first, int count, interval& ray_t, hit_record& rec) const {
+            bool hit_anything = false;
+            for (int k = first; k < first + count; ++k) {
+                if (self->objects[k]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+    };
 };
 
-#endif // BVH_H
\ No newline at end of file
+#endif // BVH_H
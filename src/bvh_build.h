@@ -0,0 +1,457 @@
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+enum class bvh_split_method {
+    median, // Split at the primitive-count median along the longest axis
+    sah,    // Binned surface area heuristic
+    lbvh,   // Morton-code linear BVH: splits where the sorted codes' leading bit changes
+    hlbvh,  // LBVH treelets joined by a binned SAH build of the levels above them
+    sbvh    // Binned SAH that may also split space, duplicating primitives that straddle the plane
+};
+
+const int bvh_max_leaf_size = 65535; // Flattened nodes store leaf primitive counts in 16 bits
+
+struct bvh_build_options {
+    bvh_split_method split = bvh_split_method::sah;
+    int sah_bins = 16; // Bins per axis; the split candidates are the bin boundaries
+    int max_leaf_size = 4; // Most primitives a leaf may hold
+    double traversal_cost = 1.0; // Cost of visiting a node, relative to one primitive test
+    int build_threads = 0; // Threads used by the build (0 uses every hardware thread); the tree is the same for any count
+    int morton_bits = 30; // Morton code length of the LBVH builders: 30 or 63
+    int treelet_bits = 12; // Leading Morton bits that group primitives into the treelets of the LBVH builders
+    int width = 4; // Children per node of the traversal layout: 2 (binary), 4 or 8
+    double sbvh_max_growth = 0.3; // Extra primitive references an SBVH may add, as a fraction of the primitive count
+    double sbvh_overlap = 1e-5; // Spatial splits are tried where the best object split's children overlap by more than this fraction of the root's area
+};
+
+struct bvh_build_node {
+    aabb bbox;
+    int left = -1, right = -1; // Children of an interior node
+    int first = 0, count = 0; // Range of the primitive order held by a leaf (count > 0)
+    int axis = 0; // Split axis of an interior node
+};
+
+struct bvh_quality {
+    double sah_cost = 0.0; // Expected cost of a ray that hits the root, in primitive tests
+    int depth = 0; // Longest root-to-leaf path, counting the root as depth 1
+    int node_count = 0;
+    int leaf_count = 0;
+    double duplication = 1.0; // Primitive references in the leaves per primitive; above 1 only for spatial splits
+};
+
+struct bvh_build_result {
+    // A binary BVH over primitives given only by their bounding boxes. Nodes are stored depth
+    // first with the root at index 0; leaves refer to ranges of `order`, which lists primitive
+    // indices in leaf order.
+    std::vector<bvh_build_node> nodes;
+    std::vector<int> order;
+    bvh_quality quality;
+};
+
+inline double surface_area(const aabb& box) {
+    double dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+    if (dx < 0 || dy < 0 || dz < 0)
+        return 0.0;
+    return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+inline float round_down_to_float(double x) {
+    // The largest float not above x.
+    float f = static_cast<float>(x);
+    return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float round_up_to_float(double x) {
+    // The smallest float not below x.
+    float f = static_cast<float>(x);
+    return (f < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+inline point3 centroid(const aabb& box) {
+    return point3(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+}
+
+inline void measure_bvh(bvh_build_result& tree, const bvh_build_options& options) {
+    // Fills in the quality statistics of a built tree. The SAH cost weights every node by the
+    // probability, relative to the root, that a ray hitting the root also hits the node.
+    bvh_quality& q = tree.quality;
+    q = bvh_quality();
+    q.node_count = static_cast<int>(tree.nodes.size());
+    if (tree.nodes.empty())
+        return;
+
+    double root_area = fmax(surface_area(tree.nodes[0].bbox), 1e-300);
+    std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+    while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        const bvh_build_node& node = tree.nodes[index];
+        double probability = surface_area(node.bbox) / root_area;
+        q.depth = std::max(q.depth, depth);
+        if (node.count > 0) {
+            q.sah_cost += probability * node.count;
+            ++q.leaf_count;
+        } else {
+            q.sah_cost += probability * options.traversal_cost;
+            stack.push_back({ node.left, depth + 1 });
+            stack.push_back({ node.right, depth + 1 });
+        }
+    }
+}
+
+inline int sah_bin_index(double c, double cmin, double scale, int bins) {
+    // The bin of `bins` equal bins starting at cmin, `scale` bins per unit, that holds c.
+    int i = static_cast<int>((c - cmin) * scale);
+    return (i < 0) ? 0 : (i >= bins) ? bins - 1 : i;
+}
+
+struct sah_bin {
+    aabb bbox = aabb::empty;
+    int entries = 0; // Primitives whose extent along the axis starts in the bin
+    int exits = 0; // Primitives whose extent ends in the bin; the same as entries when binning centroids
+};
+
+inline bool sah_sweep(const sah_bin* bins, int count, std::vector<double>& right_area, std::vector<int>& right_count,
+                      double& best_cost, int& best_split) {
+    // Evaluates the SAH at every boundary between consecutive bins of one axis: a boundary sends
+    // the primitives entering before it left and those exiting after it right. If a boundary beats
+    // best_cost, records it in best_cost and best_split (the index of its right bin) and returns
+    // true. right_area and right_count are scratch of at least `count` entries, filled by a first
+    // sweep from the right.
+    aabb right_box = aabb::empty;
+    int right_n = 0;
+    for (int i = count - 1; i > 0; --i) {
+        right_box = aabb(right_box, bins[i].bbox);
+        right_n += bins[i].exits;
+        right_area[i] = surface_area(right_box);
+        right_count[i] = right_n;
+    }
+    bool improved = false;
+    aabb left_box = aabb::empty;
+    int left_n = 0;
+    for (int i = 1; i < count; ++i) {
+        left_box = aabb(left_box, bins[i - 1].bbox);
+        left_n += bins[i - 1].entries;
+        if (left_n == 0 || right_count[i] == 0)
+            continue;
+        double cost = surface_area(left_box) * left_n + right_area[i] * right_count[i];
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_split = i;
+            improved = true;
+        }
+    }
+    return improved;
+}
+
+template <typename Body>
+void parallel_chunks(int first, int end, int chunk_size, int num_threads, const Body& body) {
+    // Calls body(chunk, chunk_first, chunk_end) for consecutive chunk_size pieces of [first, end)
+    // on up to num_threads threads.
+    int chunks = (end - first + chunk_size - 1) / chunk_size;
+    parallel_for(chunks, num_threads, [&](int c, int) {
+        int chunk_first = first + c * chunk_size;
+        body(c, chunk_first, std::min(chunk_first + chunk_size, end));
+    });
+}
+
+struct bvh_subtree {
+    // A piece of a BVH built on its own, to be stitched into the tree above it. Nodes of the tree
+    // above that stand for a subtree have a negative count and the subtree's index in `first`.
+    int first, end; // Range of the primitive order the subtree covers
+    std::vector<bvh_build_node> nodes; // The subtree's nodes, depth first from its own root
+};
+
+inline int stitch_subtrees(std::vector<bvh_build_node>& out, const std::vector<bvh_build_node>& top,
+                           const std::vector<bvh_subtree>& subtrees, int index) {
+    // Appends top node `index`, with the subtrees below it, depth first; returns its position.
+    const bvh_build_node& node = top[index];
+    int position = static_cast<int>(out.size());
+    if (node.count < 0) {
+        for (bvh_build_node copy : subtrees[node.first].nodes) {
+            if (copy.count == 0) {
+                copy.left += position;
+                copy.right += position;
+            }
+            out.push_back(copy);
+        }
+        return position;
+    }
+
+    out.push_back(node);
+    if (node.count == 0) {
+        int left = stitch_subtrees(out, top, subtrees, node.left);
+        int right = stitch_subtrees(out, top, subtrees, node.right);
+        out[position].left = left;
+        out[position].right = right;
+    }
+    return position;
+}
+
+class bvh_builder {
+public:
+    // Builds a BVH top down, partitioning a single array of primitive indices in place.
+    //
+    // Large ranges near the root are bounded, binned and partitioned in fixed-size chunks spread
+    // over the build threads; once a range is small enough it becomes a subtree task, and the
+    // tasks are built concurrently into their own node arrays and then stitched together depth
+    // first. Chunk and task boundaries depend only on range sizes, never on the thread count, so
+    // every thread count produces the same tree.
+    bvh_builder(const std::vector<aabb>& bounds, const bvh_build_options& options)
+        : bounds(bounds), options(options) {
+        this->options.sah_bins = std::max(this->options.sah_bins, 2);
+        this->options.max_leaf_size = std::clamp(this->options.max_leaf_size, 1, bvh_max_leaf_size);
+    }
+
+    bvh_build_result build() {
+        bvh_build_result tree;
+        int n = static_cast<int>(bounds.size());
+        order.resize(n);
+        for (int i = 0; i < n; ++i)
+            order[i] = i;
+
+        if (n > 0) {
+            std::vector<bvh_build_node> top;
+            std::vector<bvh_subtree> subtrees;
+            build_node(top, 0, n, &subtrees);
+            parallel_for(static_cast<int>(subtrees.size()), options.build_threads, [&](int s, int) {
+                bvh_subtree& task = subtrees[s];
+                task.nodes.reserve(2 * static_cast<size_t>(task.end - task.first));
+                build_node(task.nodes, task.first, task.end, nullptr);
+            });
+
+            tree.nodes.reserve(2 * static_cast<size_t>(n));
+            stitch_subtrees(tree.nodes, top, subtrees, 0);
+        }
+        tree.order = std::move(order);
+        measure_bvh(tree, options);
+        return tree;
+    }
+
+    static const int chunk_size = 16384; // Primitives per chunk of the parallel passes over a range
+    static const int chunked_range_size = 2 * chunk_size; // Ranges this large take the chunked passes
+
+private:
+    static const int subtree_size = 4096; // Ranges this small are built as one sequential task
+
+    const std::vector<aabb>& bounds;
+    bvh_build_options options;
+    std::vector<int> order;
+
+    int make_leaf(std::vector<bvh_build_node>& nodes, int index, int first, int count) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+
+    int build_node(std::vector<bvh_build_node>& nodes, int first, int end, std::vector<bvh_subtree>* subtrees) {
+        // Builds the node over order[first, end) and its subtree into `nodes`. If subtrees is
+        // given, small ranges are left to subtree tasks, marked in `nodes` by a negative count.
+        int index = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+        int count = end - first;
+        if (subtrees && count <= subtree_size) {
+            nodes[index].count = -1;
+            nodes[index].first = static_cast<int>(subtrees->size());
+            subtrees->push_back({ first, end, {} });
+            return index;
+        }
+
+        aabb box;
+        interval centroid_bounds[3];
+        range_bounds(first, end, box, centroid_bounds);
+        nodes[index].bbox = box;
+
+        if (count == 1)
+            return make_leaf(nodes, index, first, count);
+
+        int axis, mid;
+        if (options.split == bvh_split_method::sah) {
+            if (!split_sah(first, end, box, centroid_bounds, axis, mid))
+                return make_leaf(nodes, index, first, count);
+        } else {
+            if (count <= options.max_leaf_size)
+                return make_leaf(nodes, index, first, count);
+            split_median(first, end, box, axis, mid);
+        }
+
+        nodes[index].axis = axis;
+        int left = build_node(nodes, first, mid, subtrees);
+        int right = build_node(nodes, mid, end, subtrees);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        return index;
+    }
+
+    template <typename Body>
+    void for_chunks(int first, int end, const Body& body) {
+        parallel_chunks(first, end, chunk_size, options.build_threads, body);
+    }
+
+    void range_bounds(int first, int end, aabb& box, interval* centroid_bounds) {
+        // Bounds of the primitives in order[first, end) and of their centroids.
+        struct range_box {
+            aabb box = aabb::empty;
+            interval centroids[3] = { interval::empty, interval::empty, interval::empty };
+        };
+        auto accumulate = [this](range_box& r, int from, int to) {
+            for (int k = from; k < to; ++k) {
+                const aabb& b = bounds[order[k]];
+                r.box = aabb(r.box, b);
+                point3 c = centroid(b);
+                for (int a = 0; a < 3; ++a)
+                    r.centroids[a] = interval(r.centroids[a], interval(c[a], c[a]));
+            }
+        };
+
+        range_box total;
+        if (end - first < chunked_range_size) {
+            accumulate(total, first, end);
+        } else {
+            std::vector<range_box> partial((end - first + chunk_size - 1) / chunk_size);
+            for_chunks(first, end, [&](int c, int from, int to) { accumulate(partial[c], from, to); });
+            for (const range_box& r : partial) {
+                total.box = aabb(total.box, r.box);
+                for (int a = 0; a < 3; ++a)
+                    total.centroids[a] = interval(total.centroids[a], r.centroids[a]);
+            }
+        }
+        box = total.box;
+        for (int a = 0; a < 3; ++a)
+            centroid_bounds[a] = total.centroids[a];
+    }
+
+    template <typename Predicate>
+    int partition_range(int first, int end, const Predicate& goes_left) {
+        // Moves the primitives of order[first, end) that satisfy the predicate to the front and
+        // returns the end of that group. Large ranges use a stable partition over chunks: count
+        // each chunk's left side, then scatter every chunk to its offset in a scratch array.
+        int count = end - first;
+        if (count < chunked_range_size)
+            return static_cast<int>(std::partition(order.begin() + first, order.begin() + end, goes_left) - order.begin());
+
+        int chunks = (count + chunk_size - 1) / chunk_size;
+        std::vector<int> left_counts(chunks, 0);
+        for_chunks(first, end, [&](int c, int from, int to) {
+            for (int k = from; k < to; ++k)
+                left_counts[c] += goes_left(order[k]) ? 1 : 0;
+        });
+
+        int left_total = 0;
+        for (int c = 0; c < chunks; ++c)
+            left_total += left_counts[c];
+
+        std::vector<int> scratch(count);
+        for_chunks(first, end, [&](int c, int from, int to) {
+            int left_before = 0;
+            for (int d = 0; d < c; ++d)
+                left_before += left_counts[d];
+            int left = left_before;
+            int right = left_total + (from - first - left_before);
+            for (int k = from; k < to; ++k)
+                scratch[goes_left(order[k]) ? left++ : right++] = order[k];
+        });
+        for_chunks(first, end, [&](int, int from, int to) {
+            std::copy(scratch.begin() + (from - first), scratch.begin() + (to - first), order.begin() + from);
+        });
+        return first + left_total;
+    }
+
+    void split_median(int first, int end, const aabb& box, int& axis, int& mid) {
+        // Splits at the median of the boxes' lower bounds along the longest axis of the node.
+        axis = box.longest_axis();
+        mid = first + (end - first) / 2;
+        const auto& b = bounds;
+        std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + end,
+            [&b, axis](int p, int q) { return b[p].axis(axis).min < b[q].axis(axis).min; });
+    }
+
+    void bin_range(int first, int end, const interval* centroid_bounds, sah_bin* bin_data) {
+        // Adds the primitives of order[first, end) to the bins of every axis (bins * 3 entries).
+        int bins = options.sah_bins;
+        double scale[3];
+        for (int a = 0; a < 3; ++a)
+            scale[a] = (centroid_bounds[a].size() > 0) ? bins / centroid_bounds[a].size() : 0.0;
+        for (int k = first; k < end; ++k) {
+            const aabb& b = bounds[order[k]];
+            point3 c = centroid(b);
+            for (int a = 0; a < 3; ++a) {
+                if (scale[a] == 0.0) continue;
+                sah_bin& target = bin_data[a * bins + sah_bin_index(c[a], centroid_bounds[a].min, scale[a], bins)];
+                target.bbox = aabb(target.bbox, b);
+                ++target.entries;
+                ++target.exits;
+            }
+        }
+    }
+
+    bool split_sah(int first, int end, const aabb& box, const interval* centroid_bounds, int& axis, int& mid) {
+        // Bins the primitive centroids along each axis and evaluates the SAH at every bin boundary.
+        // Returns false if a leaf is cheaper than the best split and small enough to be one.
+        int count = end - first;
+        int bins = options.sah_bins;
+        std::vector<sah_bin> bin_data(3 * static_cast<size_t>(bins));
+        if (count < chunked_range_size) {
+            bin_range(first, end, centroid_bounds, bin_data.data());
+        } else {
+            std::vector<std::vector<sah_bin>> partial((count + chunk_size - 1) / chunk_size);
+            for_chunks(first, end, [&](int c, int from, int to) {
+                partial[c].resize(bin_data.size());
+                bin_range(from, to, centroid_bounds, partial[c].data());
+            });
+            for (const auto& p : partial) {
+                for (size_t i = 0; i < bin_data.size(); ++i) {
+                    bin_data[i].bbox = aabb(bin_data[i].bbox, p[i].bbox);
+                    bin_data[i].entries += p[i].entries;
+                    bin_data[i].exits += p[i].exits;
+                }
+            }
+        }
+
+        double best_cost = infinity;
+        int best_axis = -1, best_split = 0;
+        std::vector<double> right_area(bins);
+        std::vector<int> right_count(bins);
+        for (int a = 0; a < 3; ++a) {
+            if (!(centroid_bounds[a].size() > 0))
+                continue;
+            if (sah_sweep(bin_data.data() + a * bins, bins, right_area, right_count, best_cost, best_split))
+                best_axis = a;
+        }
+
+        double area = fmax(surface_area(box), 1e-300);
+        double split_cost = options.traversal_cost + best_cost / area;
+        bool must_split = count > options.max_leaf_size;
+
+        if (best_axis < 0) {
+            // All centroids coincide, so no boundary separates them: split the range in half.
+            if (!must_split)
+                return false;
+            axis = box.longest_axis();
+            mid = first + count / 2;
+            return true;
+        }
+        if (!must_split && count <= split_cost)
+            return false;
+
+        axis = best_axis;
+        double cmin = centroid_bounds[axis].min;
+        double scale = bins / centroid_bounds[axis].size();
+        const auto& b = bounds;
+        mid = partition_range(first, end,
+            [&b, axis, cmin, scale, bins, best_split](int p) { return sah_bin_index(centroid(b[p])[axis], cmin, scale, bins) < best_split; });
+        return true;
+    }
+};
+
+#endif // BVH_BUILD_H
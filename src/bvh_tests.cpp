@@ -0,0 +1,240 @@
+// BVH tests, run by CTest: each checks the acceleration structures against the simplest thing
+// that must agree with them, and prints one line per configuration and FAILED on a mismatch.
+//
+// - Traversal: for every BVH width, split method, leaf format and vertex storage, the closest
+//   hit of single rays and of ray packets through a triangle_mesh equals the closest hit found
+//   by testing the ray against every triangle of the mesh as stored.
+// - Build determinism: the tree built with any number of build threads is the same as the tree
+//   built on one thread, node for node.
+//
+// The meshes are generated, so the tests need no resources.
+//
+// Usage: RayTracingTests
+
+#include "rtweekend.h"
+
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+    mesh bumpy_sphere(int rings, int segments, int scattered, uint64_t seed) {
+        // A closed sphere of rings x segments quads split into triangles, with its radius jittered
+        // per vertex, and `scattered` triangles strewn through it, so leaves overlap and rays meet
+        // shared edges and vertices.
+        pcg32 rng(seed, 1);
+        std::vector<double> x, y, z;
+        std::vector<int> indices;
+        auto add_vertex = [&](const point3& p) {
+            x.push_back(p.x()); y.push_back(p.y()); z.push_back(p.z());
+            return static_cast<int>(x.size()) - 1;
+        };
+        int top = add_vertex(point3(0, 1, 0));
+        for (int i = 1; i < rings; ++i) {
+            double theta = pi * i / rings;
+            for (int j = 0; j < segments; ++j) {
+                double phi = 2 * pi * j / segments;
+                double radius = 1 + 0.1 * (rng.next_double() - 0.5);
+                add_vertex(radius * point3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+            }
+        }
+        int bottom = add_vertex(point3(0, -1, 0));
+        auto ring_vertex = [&](int i, int j) { return 1 + (i - 1) * segments + (j % segments); };
+        for (int j = 0; j < segments; ++j) {
+            indices.insert(indices.end(), { top, ring_vertex(1, j + 1), ring_vertex(1, j) });
+            indices.insert(indices.end(), { bottom, ring_vertex(rings - 1, j), ring_vertex(rings - 1, j + 1) });
+            for (int i = 1; i < rings - 1; ++i) {
+                int a = ring_vertex(i, j), b = ring_vertex(i, j + 1), c = ring_vertex(i + 1, j), d = ring_vertex(i + 1, j + 1);
+                indices.insert(indices.end(), { a, b, c, b, d, c });
+            }
+        }
+        for (int k = 0; k < scattered; ++k) {
+            point3 center(rng.next_double() * 1.6 - 0.8, rng.next_double() * 1.6 - 0.8, rng.next_double() * 1.6 - 0.8);
+            for (int v = 0; v < 3; ++v) {
+                vec3 offset(rng.next_double() - 0.5, rng.next_double() - 0.5, rng.next_double() - 0.5);
+                indices.push_back(add_vertex(center + 0.3 * offset));
+            }
+        }
+        return mesh(shared_array<double>(std::move(x)), shared_array<double>(std::move(y)), shared_array<double>(std::move(z)),
+                    shared_array<int>(std::move(indices)));
+    }
+
+    double brute_force_hit(const mesh& m, const ray& r, const interval& ray_t) {
+        // Distance to the closest triangle the ray hits, or infinity.
+        double closest = ray_t.max;
+        for (int k = 0; k < static_cast<int>(m.triangle_count()); ++k) {
+            point3 v0, v1, v2;
+            m.triangle_vertices(k, v0, v1, v2);
+            double t, u, v;
+            if (intersect_triangle(r, v0, v1, v2, interval(ray_t.min, closest), t, u, v))
+                closest = t;
+        }
+        return closest;
+    }
+
+    bool same_hit(double t, double expected) {
+        // The kernels differ from the brute-force test in their last bits.
+        if (std::isinf(expected) || std::isinf(t))
+            return t == expected;
+        return std::fabs(t - expected) <= 1e-9 * expected;
+    }
+
+    const char* split_name(bvh_split_method split) {
+        switch (split) {
+            case bvh_split_method::median: return "median";
+            case bvh_split_method::sah: return "sah";
+            case bvh_split_method::lbvh: return "lbvh";
+            case bvh_split_method::hlbvh: return "hlbvh";
+            case bvh_split_method::sbvh: return "sbvh";
+        }
+        return "?";
+    }
+
+    const char* storage_name(mesh_storage storage) {
+        switch (storage) {
+            case mesh_storage::full: return "full";
+            case mesh_storage::float32: return "float";
+            case mesh_storage::unorm16: return "unorm16";
+        }
+        return "?";
+    }
+
+    const bvh_split_method split_methods[] = {
+        bvh_split_method::median, bvh_split_method::sah, bvh_split_method::lbvh, bvh_split_method::hlbvh, bvh_split_method::sbvh
+    };
+
+    bool test_traversal() {
+        // Half the packets share an origin outside the mesh, the other half have an origin per
+        // ray, some inside the mesh; every ray aims at a random point inside it.
+        const int packet_count = 64;
+        const uint32_t all_lanes = (1u << packet_size) - 1;
+        const interval ray_t(0.001, infinity);
+        mesh geometry = bumpy_sphere(24, 48, 60, 7);
+
+        pcg32 rng(11, 2);
+        auto random_point = [&](double extent) {
+            return point3(extent * (2 * rng.next_double() - 1), extent * (2 * rng.next_double() - 1), extent * (2 * rng.next_double() - 1));
+        };
+        std::vector<ray> rays;
+        for (int p = 0; p < packet_count; ++p) {
+            point3 shared_origin = 3 * unit_vector(random_point(1));
+            for (int l = 0; l < packet_size; ++l) {
+                point3 origin = (p % 2 == 0) ? shared_origin : random_point(2);
+                rays.push_back(ray(origin, random_point(0.7) - origin));
+            }
+        }
+
+        bool passed = true;
+        for (mesh_storage storage : { mesh_storage::full, mesh_storage::float32, mesh_storage::unorm16 }) {
+            // The expected hits are found on the triangles as stored, which compressed storages
+            // move slightly.
+            mesh stored = triangle_mesh(geometry, nullptr, bvh_build_options(), mesh_leaf_format::indexed, storage).triangles();
+            std::vector<double> expected(rays.size());
+            for (size_t k = 0; k < rays.size(); ++k)
+                expected[k] = brute_force_hit(stored, rays[k], ray_t);
+
+            for (int width : { 2, 4, 8 })
+            for (bvh_split_method split : split_methods)
+            for (mesh_leaf_format format : { mesh_leaf_format::indexed, mesh_leaf_format::batched }) {
+                bvh_build_options options;
+                options.width = width;
+                options.split = split;
+                triangle_mesh object(geometry, nullptr, options, format, storage);
+
+                int ray_errors = 0, packet_errors = 0;
+                for (int p = 0; p < packet_count; ++p) {
+                    ray_packet packet;
+                    for (int l = 0; l < packet_size; ++l)
+                        packet.set(l, rays[p * packet_size + l]);
+                    packet.finalize(all_lanes);
+                    packet_hits hits;
+                    hits.reset(ray_t.max);
+                    object.hit_packet(packet, all_lanes, ray_t.min, hits);
+
+                    for (int l = 0; l < packet_size; ++l) {
+                        size_t k = p * packet_size + l;
+                        hit_record rec;
+                        double t = object.hit(rays[k], ray_t, rec) ? rec.t : infinity;
+                        double packet_t = (hits.hit_mask & (1u << l)) ? hits.t[l] : infinity;
+                        if (!same_hit(t, expected[k]))
+                            ++ray_errors;
+                        if (!same_hit(packet_t, expected[k]))
+                            ++packet_errors;
+                    }
+                }
+
+                bool ok = ray_errors == 0 && packet_errors == 0;
+                std::printf("traversal width %d, %s, %s leaves, %s storage: %d ray and %d packet mismatches of %zu%s\n",
+                            width, split_name(split), (format == mesh_leaf_format::indexed) ? "indexed" : "batched",
+                            storage_name(storage), ray_errors, packet_errors, rays.size(), ok ? "" : " FAILED");
+                passed = passed && ok;
+            }
+        }
+        return passed;
+    }
+
+    template <int N>
+    bool same_nodes(const wide_bvh<N>& a, const wide_bvh<N>& b) {
+        if (a.nodes.size() != b.nodes.size() || a.depth != b.depth)
+            return false;
+        for (size_t i = 0; i < a.nodes.size(); ++i) {
+            const wide_bvh_node<N>& x = a.nodes[i];
+            const wide_bvh_node<N>& y = b.nodes[i];
+            if (std::memcmp(x.bounds, y.bounds, sizeof(x.bounds)) != 0 || std::memcmp(x.child, y.child, sizeof(x.child)) != 0
+                || std::memcmp(x.count, y.count, sizeof(x.count)) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    bool same_tree(const bvh_layout& a, const bvh_layout& b) {
+        const shared_array<int>& order_a = a.order();
+        const shared_array<int>& order_b = b.order();
+        if (a.width != b.width || order_a.size() != order_b.size()
+            || !std::equal(order_a.data(), order_a.data() + order_a.size(), order_b.data()))
+            return false;
+        if (a.width == 8)
+            return same_nodes(a.wide8, b.wide8);
+        if (a.width == 4)
+            return same_nodes(a.wide4, b.wide4);
+        return a.binary.nodes.size() == b.binary.nodes.size() && a.binary.depth == b.binary.depth
+            && std::memcmp(a.binary.nodes.data(), b.binary.nodes.data(), a.binary.nodes.size() * sizeof(linear_bvh_node)) == 0;
+    }
+
+    bool test_build_determinism() {
+        // Large enough that the top-level range is bounded, binned and partitioned in chunks and
+        // the levels below become subtree tasks. The width only changes how the built tree is
+        // flattened, so one is enough.
+        mesh geometry = bumpy_sphere(90, 200, 400, 13);
+        if (geometry.triangle_count() < static_cast<size_t>(bvh_builder::chunked_range_size)) {
+            std::printf("build: %zu triangles take no chunked passes FAILED\n", geometry.triangle_count());
+            return false;
+        }
+        bool passed = true;
+        for (bvh_split_method split : split_methods) {
+            bvh_build_options options;
+            options.split = split;
+            options.build_threads = 1;
+            bvh_layout reference = triangle_mesh::build_layout(geometry, options);
+            for (int threads : { 3, 8 }) {
+                options.build_threads = threads;
+                bool ok = same_tree(triangle_mesh::build_layout(geometry, options), reference);
+                std::printf("build %s, %d threads: %s\n", split_name(split), threads,
+                            ok ? "same tree as 1 thread" : "tree differs from 1 thread FAILED");
+                passed = passed && ok;
+            }
+        }
+        return passed;
+    }
+}
+
+int main() {
+    bool passed = test_traversal();
+    passed = test_build_determinism() && passed;
+    std::printf(passed ? "All tests passed\n" : "Some tests FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -4,11 +4,22 @@
 #include "rtweekend.h"
 
 #include "color.h"
+#include "film.h"
 #include "hittable.h"
 #include "material.h"
 #include "pdf.h"
-
+#include "parallel.h"
+#include "sampler.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <string>
+#include <vector>
 
 class camera {
 public:
@@ -16,6 +27,8 @@ public:
     int image_width = 100; // Rendered image width in pixel count
     int samples_per_pixel = 10; // Count of random samples for each pixel
     int max_depth = 10; // Maximum number of ray bounces into scene
+    int rr_start_depth = 5; // Bounce from which Russian roulette may terminate paths; >= max_depth disables it
+    double rr_min_survival = 0.05; // Lowest survival probability Russian roulette gives a path
     color background; // Scene background color
 
     double vfov = 90; // Vertical view angle (field of view)
@@ -26,32 +39,98 @@ public:
     double defocus_angle = 0; // Variation angle of rays through each pixel
     double focus_dist = 10; // Distance from camera lookfrom point to plane of perfect focus
 
+    int num_threads = 0; // Number of render threads (0 uses every hardware thread)
+    int tile_size = 16; // Width and height in pixels of the image tiles handed to render threads
+    uint64_t seed = 0; // Seed for the per-sample random streams; same seed gives the same image
+    sampler_type sampling = sampler_type::sobol; // Sample pattern for pixel, lens, light and BSDF dimensions
+
+    bool adaptive_sampling = false; // Stop sampling each pixel once its estimated error is low enough
+    int min_samples_per_pixel = 64; // Samples every pixel takes before it may stop early
+    int max_samples_per_pixel = 0; // Sample cap for noisy pixels (0 uses samples_per_pixel)
+    double adaptive_threshold = 0.01; // Relative standard error of pixel luminance at which a pixel stops
+    std::string sample_map_file; // If set, a PGM image of the per-pixel sample counts is written here
+    std::string stats_file; // If set and statistics are compiled in (RT_STATS), they are also written here as JSON
+    std::string output_file; // If set, the image is written here (.ppm, .pfm or .hdr) instead of stdout
+
+    int pass_samples = 0; // Samples added to each pixel per progressive pass (0 renders in one pass)
+    std::string checkpoint_file; // If set, progressive renders periodically save their state here
+    double checkpoint_interval = 60; // Minimum number of seconds between checkpoints
+    bool resume = false; // Continue from checkpoint_file, adding samples up to samples_per_pixel
+
+    // Trace batches of paths stage by stage instead of one path at a time. Wavefront renders take
+    // every pixel to samples_per_pixel in one pass: adaptive_sampling and pass_samples (and so
+    // checkpoints) are ignored, with a warning.
+    bool wavefront = false;
+    // Most paths in flight per wavefront batch; a batch never holds more than the image's
+    // width * height * samples_per_pixel. Each path's state takes about 250 bytes, so a full
+    // batch of the default 1 << 20 paths needs about 260 MB.
+    int wavefront_paths = 1 << 20;
+
+    bool packet_tracing = false; // Trace primary rays of neighbouring pixels together in SIMD packets
+
+    bool write_image = true; // Write the finished image to output_file (or stdout)
+
     void render(const hittable& world, const hittable& lights) {
         initialize();
 
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-        int sqrt_spp = std::sqrt(samples_per_pixel);
-        for (int j = 0; j < image_height; ++j){
-            std::clog << "\rScanline remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; ++i) {
-                color pixel_color(0, 0, 0);
-                for (int s_j = 0; s_j < sqrt_spp; ++s_j) {
-                    for (int s_i = 0; s_i < sqrt_spp; ++s_i) {
-                        ray r = get_ray(i, j, s_i, s_j);
-                        pixel_color += ray_color(r, max_depth, world, lights);
-                    }
-                }
-                write_color(std::cout, pixel_color, samples_per_pixel);
-            }
+        // Tiles are scheduled dynamically, so expensive tiles (glass, metal) don't hold up the
+        // threads that drew cheap ones. Pixels land in the film and the image is written out once
+        // every tile is finished.
+        image = film(image_width, image_height);
+        std::vector<tile> tiles = make_tiles();
+        stats_reset();
+        int tile_count = static_cast<int>(tiles.size());
+        std::atomic<long long> rays(0);
+
+        if (wavefront) {
+            if (adaptive_sampling || pass_samples > 0)
+                std::clog << "Warning: wavefront rendering ignores adaptive sampling and progressive passes\n";
+            render_wavefront(world, lights, rays);
+        } else if (pass_samples > 0) {
+            render_progressive(world, lights, tiles, rays);
+        } else {
+            std::atomic<int> tiles_done(0);
+            parallel_for(tile_count, num_threads, [&](int t, int thread_index) {
+                render_tile(tiles[t], world, lights);
+                rays += take_thread_rays();
+                int done = ++tiles_done;
+                if (thread_index == 0)
+                    std::clog << "\rTiles remaining: " << (tile_count - done) << ' ' << std::flush;
+            });
+        }
+
+        ray_count = rays;
+        end_pixel_samples(); // The other render threads have exited; this one outlives pixel_sampler
+
+        if (write_image) {
+            if (output_file.empty())
+                image.write_ppm_ascii(std::cout);
+            else
+                image.write(output_file);
+        }
+
+        if (adaptive_sampling || pass_samples > 0)
+            std::clog << "\rAverage samples per pixel: "
+                      << static_cast<double>(image.total_samples()) / image.pixel_count() << '\n';
+        if (!sample_map_file.empty())
+            write_sample_map();
+        if (stats_enabled) {
+            stats_block stats = stats_collect();
+            stats_report(stats, std::clog);
+            if (!stats_file.empty())
+                stats_write_json(stats, stats_file);
         }
 
         std::clog << "\rDone.                 \n";
     }
 
+    const film& rendered_image() const { return image; } // Linear radiance of the last render
+    long long rays_traced() const { return ray_count; } // Path segments traced by the last render
+
 private:
     int image_height; // Rendered image height
-    int sqrt_spp; // Square root of number of samples per pixel
-    double recip_sqrt_spp; // 1 / sqrt_spp
+    int adaptive_min_spp; // Clamped minimum sample count for adaptive sampling
+    int adaptive_max_spp; // Clamped maximum sample count for adaptive sampling
     point3 center; // Camera center
     point3 pixel00_loc; // Location of pixel 0, 0
     vec3 pixel_delta_u; // Offset to pixel to the right
@@ -59,6 +138,28 @@ private:
     vec3 right, up, forward; // Camera frame basis vectors
     vec3 defocus_disk_u; // Defocus disk horizontal radius
     vec3 defocus_disk_v; // Defocus disk vertical radius
+    film image; // Accumulated radiance of the image being rendered
+    std::shared_ptr<sampler> pixel_sampler; // Sample pattern of the current render
+    long long ray_count = 0; // Path segments traced by the last render
+
+    struct tile {
+        int x0, y0; // Upper left pixel of the tile
+        int x1, y1; // One past the lower right pixel of the tile
+        unsigned int order; // Position of the tile along the Morton curve
+    };
+
+    static long long& thread_ray_count() {
+        // Rays traced by the calling thread since its last take_thread_rays(). Kept per thread so
+        // the inner loop never touches shared memory.
+        thread_local long long count = 0;
+        return count;
+    }
+
+    static long long take_thread_rays() {
+        long long count = thread_ray_count();
+        thread_ray_count() = 0;
+        return count;
+    }
 
     void initialize() {
         image_height = static_cast<int>(image_width / aspect_ratio);
@@ -73,8 +174,15 @@ private:
         double viewport_height = 2 * h * focus_dist;
         double viewport_width = viewport_height * (static_cast<double>(image_width) / image_height);
 
-        sqrt_spp = static_cast<int>(sqrt(samples_per_pixel));
-        recip_sqrt_spp = 1.0 / sqrt_spp;
+        adaptive_max_spp = (max_samples_per_pixel > 0) ? max_samples_per_pixel : samples_per_pixel;
+        adaptive_max_spp = (adaptive_max_spp < 1) ? 1 : adaptive_max_spp;
+        adaptive_min_spp = std::min(std::max(min_samples_per_pixel, 1), adaptive_max_spp);
+
+        // The samplers handle any sample count, and every render mode draws sample n of a pixel
+        // from the same point of the pattern.
+        int max_spp = adaptive_sampling ? adaptive_max_spp : std::max(samples_per_pixel, 1);
+        pixel_sampler = make_sampler(sampling, max_spp, image_width, image_height);
+        take_thread_rays();
 
         // Calculate the unit basis vectors for the camera coordinate frame.
         forward = unit_vector(lookat - lookfrom);
@@ -99,70 +207,376 @@ private:
         defocus_disk_v = up * defocus_radius;
     }
 
-    ray get_ray(int i, int j, int s_i, int s_j) const {
-        // Get a randomly sampled camera ray for the pixel at location i, j, originating from the camera defocus disk
+    std::vector<tile> make_tiles() const {
+        // Splits the image into tiles, sorted along a Morton (Z-order) curve so that each render
+        // thread's initial block of tiles covers a compact region of the image.
+        int size = (tile_size < 1) ? 1 : tile_size;
+        std::vector<tile> tiles;
+        for (int ty = 0; ty * size < image_height; ++ty) {
+            for (int tx = 0; tx * size < image_width; ++tx) {
+                int x0 = tx * size;
+                int y0 = ty * size;
+                tiles.push_back({ x0, y0, std::min(x0 + size, image_width), std::min(y0 + size, image_height),
+                                  morton_code(tx, ty) });
+            }
+        }
+        std::sort(tiles.begin(), tiles.end(), [](const tile& a, const tile& b) { return a.order < b.order; });
+        return tiles;
+    }
+
+    static unsigned int morton_code(unsigned int x, unsigned int y) {
+        // Interleaves the low 16 bits of x and y.
+        auto spread = [](unsigned int v) {
+            v &= 0x0000ffff;
+            v = (v | (v << 8)) & 0x00ff00ff;
+            v = (v | (v << 4)) & 0x0f0f0f0f;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    void render_tile(const tile& t, const hittable& world, const hittable& lights) {
+        if (packet_tracing && !adaptive_sampling) {
+            render_tile_packets(t, world, lights);
+            return;
+        }
+
+        for (int j = t.y0; j < t.y1; ++j) {
+            for (int i = t.x0; i < t.x1; ++i) {
+                if (adaptive_sampling) {
+                    render_pixel_adaptive(i, j, world, lights);
+                    continue;
+                }
+
+                color pixel_color(0, 0, 0);
+                double luminance_sq_sum = 0.0;
+                for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                    start_pixel_sample(pixel_sampler.get(), seed, i, j, image_width, sample);
+                    ray r = get_ray(i, j);
+                    color sample_color = zero_nan(ray_color(r, world, lights));
+                    pixel_color += sample_color;
+                    luminance_sq_sum += luminance(sample_color) * luminance(sample_color);
+                }
+                image.add(i, j, pixel_color, luminance_sq_sum, samples_per_pixel);
+            }
+        }
+    }
+
+    void render_tile_packets(const tile& t, const hittable& world, const hittable& lights) {
+        // Groups the pixels of the tile into small blocks, one pixel per packet lane, and traces the
+        // primary rays of each sample index of the block as one packet. Every lane then continues its
+        // path on its own from the primary hit. Lanes use the same random streams as render_tile.
+        // A hit test that draws random numbers (a constant_medium) would draw them from whichever
+        // stream the packet left current rather than from its lane's, so a packet during which
+        // anything was drawn is discarded and its lanes traced one by one; the image is then the
+        // same as without packets.
+        const int block_w = (packet_size == 4) ? 2 : 4;
+        const int block_h = packet_size / block_w;
+
+        for (int by = t.y0; by < t.y1; by += block_h) {
+            for (int bx = t.x0; bx < t.x1; bx += block_w) {
+                uint32_t active = 0;
+                int lane_i[packet_size], lane_j[packet_size];
+                color lane_color[packet_size];
+                double lane_luminance_sq[packet_size];
+                for (int l = 0; l < packet_size; ++l) {
+                    lane_i[l] = bx + l % block_w;
+                    lane_j[l] = by + l / block_w;
+                    lane_color[l] = color(0, 0, 0);
+                    lane_luminance_sq[l] = 0.0;
+                    if (lane_i[l] < t.x1 && lane_j[l] < t.y1)
+                        active |= 1u << l;
+                }
+
+                ray_packet packet;
+                packet_hits hits;
+                for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                    for (int l = 0; l < packet_size; ++l) {
+                        if (!(active & (1u << l))) {
+                            packet.set(l, ray(center, forward));
+                            continue;
+                        }
+                        start_pixel_sample(pixel_sampler.get(), seed, lane_i[l], lane_j[l], image_width, sample);
+                        packet.set(l, get_ray(lane_i[l], lane_j[l]));
+                    }
+                    packet.finalize(active);
+                    hits.reset(infinity);
+                    const thread_random_state& random = thread_random();
+                    pcg32 rng_before = random.rng;
+                    uint32_t dimension_before = random.dimension;
+                    world.hit_packet(packet, active, 0.001, hits);
+                    bool drew_random = !(random.rng == rng_before) || random.dimension != dimension_before;
+
+                    for (int l = 0; l < packet_size; ++l) {
+                        if (!(active & (1u << l))) continue;
+                        start_pixel_sample(pixel_sampler.get(), seed, lane_i[l], lane_j[l], image_width, sample);
+                        color sample_color = zero_nan(ray_color(packet.lane_ray(l), world, lights, drew_random ? nullptr : &hits, l));
+                        lane_color[l] += sample_color;
+                        lane_luminance_sq[l] += luminance(sample_color) * luminance(sample_color);
+                    }
+                }
+
+                for (int l = 0; l < packet_size; ++l)
+                    if (active & (1u << l))
+                        image.add(lane_i[l], lane_j[l], lane_color[l], lane_luminance_sq[l], samples_per_pixel);
+            }
+        }
+    }
+
+    void render_pixel_adaptive(int i, int j, const hittable& world, const hittable& lights) {
+        // Takes samples in batches. Once the minimum count is reached, the pixel stops as soon as
+        // pixel_converged() says so, so flat and dark regions stop early and noisy ones (caustics,
+        // glossy reflections) run on to the cap.
+        const int batch_size = 16;
+        int pixel_index = j * image_width + i;
+
+        while (image.sample_count(pixel_index) < adaptive_max_spp) {
+            int n = image.sample_count(pixel_index);
+            int batch_end = std::min(std::max(n + batch_size, adaptive_min_spp), adaptive_max_spp);
+            sample_pixel(i, j, batch_end - n, world, lights);
+            if (pixel_converged(pixel_index))
+                break;
+        }
+    }
+
+    void sample_pixel(int i, int j, int count, const hittable& world, const hittable& lights) {
+        // Adds `count` samples to pixel i, j, continuing its sequence of sample indices.
+        int pixel_index = j * image_width + i;
+        int first = image.sample_count(pixel_index);
+
+        color pixel_color(0, 0, 0);
+        double luminance_sq_sum = 0.0;
+        for (int n = first; n < first + count; ++n) {
+            start_pixel_sample(pixel_sampler.get(), seed, i, j, image_width, n);
+            ray r = get_ray(i, j);
+            color sample_color = zero_nan(ray_color(r, world, lights));
+            pixel_color += sample_color;
+            luminance_sq_sum += luminance(sample_color) * luminance(sample_color);
+        }
+        image.add(i, j, pixel_color, luminance_sq_sum, count);
+    }
+
+    bool pixel_converged(int pixel_index) const {
+        // A pixel has converged when the standard error of its mean luminance is below
+        // adaptive_threshold relative to the mean.
+        if (image.sample_count(pixel_index) < adaptive_min_spp)
+            return false;
+        double mean = image.mean_luminance(pixel_index);
+        return image.luminance_std_error(pixel_index) <= adaptive_threshold * std::fmax(mean, 1e-3);
+    }
+
+    int pixel_target(int pixel_index) const {
+        // Returns the number of samples the pixel still wants.
+        int n = image.sample_count(pixel_index);
+        if (!adaptive_sampling)
+            return std::max(samples_per_pixel - n, 0);
+        if (pixel_converged(pixel_index))
+            return 0;
+        return std::max(adaptive_max_spp - n, 0);
+    }
+
+    void render_wavefront(const hittable& world, const hittable& lights, std::atomic<long long>& rays) {
+        wavefront_integrator integrator;
+        integrator.num_threads = num_threads;
+        integrator.max_paths = wavefront_paths;
+        integrator.max_depth = max_depth;
+        integrator.rr_start_depth = rr_start_depth;
+        integrator.rr_min_survival = rr_min_survival;
+        integrator.background = background;
+        integrator.pixel_sampler = pixel_sampler.get();
+
+        integrator.render(image, samples_per_pixel, seed, world, lights,
+                          [this](int i, int j) { return get_ray(i, j); });
+        integrator.report(std::clog);
+        rays += integrator.rays_traced();
+    }
+
+    void render_progressive(const hittable& world, const hittable& lights, const std::vector<tile>& tiles,
+                            std::atomic<long long>& rays) {
+        // Renders in passes that each add up to pass_samples samples to every pixel that still
+        // wants more. After a pass, a copy of the film is handed to a background thread that
+        // writes the checkpoint while the render threads carry on with the next pass.
+        using clock = std::chrono::steady_clock;
+
+        if (resume && !checkpoint_file.empty()) {
+            if (image.read_checkpoint(checkpoint_file, seed))
+                std::clog << "Resuming from '" << checkpoint_file << "' at "
+                          << static_cast<double>(image.total_samples()) / image.pixel_count() << " samples per pixel\n";
+            else
+                std::clog << "No usable checkpoint in '" << checkpoint_file << "', starting from scratch\n";
+        }
+
+        int tile_count = static_cast<int>(tiles.size());
+        std::future<bool> pending_checkpoint;
+        auto last_checkpoint = clock::now();
+
+        for (int pass = 1; ; ++pass) {
+            std::atomic<int> tiles_done(0);
+            std::atomic<bool> any_sampled(false);
+
+            parallel_for(tile_count, num_threads, [&](int t, int thread_index) {
+                const tile& tl = tiles[t];
+                for (int j = tl.y0; j < tl.y1; ++j) {
+                    for (int i = tl.x0; i < tl.x1; ++i) {
+                        int count = std::min(pixel_target(j * image_width + i), pass_samples);
+                        if (count <= 0) continue;
+                        sample_pixel(i, j, count, world, lights);
+                        any_sampled = true;
+                    }
+                }
+                rays += take_thread_rays();
+                int done = ++tiles_done;
+                if (thread_index == 0)
+                    std::clog << "\rPass " << pass << ", tiles remaining: " << (tile_count - done) << ' ' << std::flush;
+            });
+
+            if (!any_sampled)
+                break;
+
+            double elapsed = std::chrono::duration<double>(clock::now() - last_checkpoint).count();
+            if (!checkpoint_file.empty() && elapsed >= checkpoint_interval) {
+                if (pending_checkpoint.valid() && !pending_checkpoint.get())
+                    std::clog << "\nWarning: checkpoint not saved; the previous one is kept.\n";
+                pending_checkpoint = std::async(std::launch::async,
+                    [snapshot = image, filename = checkpoint_file, snapshot_seed = seed]() {
+                        return snapshot.write_checkpoint(filename, snapshot_seed);
+                    });
+                last_checkpoint = clock::now();
+            }
+        }
+
+        if (pending_checkpoint.valid())
+            pending_checkpoint.wait();
+        if (!checkpoint_file.empty() && !image.write_checkpoint(checkpoint_file, seed))
+            std::clog << "\nWarning: final checkpoint not saved; the previous one is kept.\n";
+    }
+
+    void write_sample_map() const {
+        // Writes the per-pixel sample counts as a plain PGM image, scaled so the largest count is white.
+        std::ofstream out(sample_map_file);
+        if (!out) {
+            std::cerr << "ERROR: Could not write sample map '" << sample_map_file << "'.\n";
+            return;
+        }
+
+        int max_count = 0;
+        for (int p = 0; p < image.pixel_count(); ++p)
+            max_count = std::max(max_count, image.sample_count(p));
+        double scale = (max_count > 0) ? 255.0 / max_count : 0.0;
+
+        out << "P2\n" << image_width << ' ' << image_height << "\n255\n";
+        for (int j = 0; j < image_height; ++j) {
+            for (int i = 0; i < image_width; ++i)
+                out << static_cast<int>(image.sample_count(j * image_width + i) * scale + 0.5) << ' ';
+            out << '\n';
+        }
+    }
+
+    ray get_ray(int i, int j) const {
+        // Get a camera ray for the pixel at location i, j, originating from the camera defocus disk.
+        // Pixel, lens and time take the first camera_dimensions of the current sample.
         point3 pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
-        // point3 pixel_sample = pixel_center + pixel_sample_square();
-        point3 pixel_sample = pixel_center + pixel_sample_square(s_i, s_j);
+        point3 pixel_sample = pixel_center + pixel_sample_square();
 
         // point3 ray_origin = center;
         point3 ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         vec3 ray_direction = pixel_sample - ray_origin;
-        double ray_time = random_double();
+        double ray_time = sample_1d();
         
         return ray(ray_origin, ray_direction, ray_time);
     }
 
-    // vec3 pixel_sample_square() const {
-    //     // Returns a random point in the square surrounding a pixel at the origin.
-    //     double px = -0.5 + random_double();
-    //     double py = -0.5 + random_double();
-    //     return (px * pixel_delta_u) + (py * pixel_delta_v);
-    // }
-
-    vec3 pixel_sample_square(int s_i, int s_j) const {
-        // Returns a random point in the square surrounding a pixel at the origin, given the two subpixel indices.
-        double px = -0.5 + recip_sqrt_spp * (s_i + random_double());
-        double py = -0.5 + recip_sqrt_spp * (s_j + random_double());
+    vec3 pixel_sample_square() const {
+        // Returns a sample point in the square surrounding a pixel at the origin.
+        double u, v;
+        sample_2d(u, v);
+        double px = -0.5 + u;
+        double py = -0.5 + v;
         return (px * pixel_delta_u) + (py * pixel_delta_v);
     }
 
     point3 defocus_disk_sample() const {
-        // Returns a random point in the camera defocus disk.
-        vec3 p = random_in_unit_disk();
+        // Returns a sample point in the camera defocus disk.
+        double u, v;
+        sample_2d(u, v);
+        vec3 p = sample_unit_disk(u, v);
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights) const {
-        hit_record rec;
-
-        if (depth <= 0)
-            return color(0, 0, 0);
+    color ray_color(const ray& r_in, const hittable& world, const hittable& lights,
+                    const packet_hits* primary = nullptr, int lane = 0) const {
+        // Traces one path iteratively, carrying the product of the BSDF weights so far as the
+        // path throughput. From rr_start_depth on, Russian roulette ends the path with probability
+        // 1 - q, where q follows the throughput (but stays at least rr_min_survival), and divides
+        // the throughput of surviving paths by q, which keeps the estimate unbiased. Without
+        // roulette (rr_start_depth >= max_depth) the expected image is that of the recursive
+        // formulation, but not its exact pixels: the loop multiplies the weights together in a
+        // different order, so results differ in rounding. If `primary` is given, the first hit is
+        // taken from that lane of an already traced packet.
+        color radiance(0, 0, 0);
+        color throughput(1, 1, 1);
+        ray r = r_in;
+        STAT_COUNT(camera_rays);
+
+        int bounce = 0;
+        for (; bounce < max_depth; ++bounce) {
+            start_random_bounce(bounce);
+            ++thread_ray_count();
+            STAT_COUNT(extension_rays);
+
+            hit_record rec;
+            bool hit_anything = (bounce == 0 && primary)
+                              ? (primary->hit_mask & (1u << lane)) != 0
+                              : world.hit(r, interval(0.001, infinity), rec);
+            if (bounce == 0 && primary && hit_anything)
+                rec = primary->rec[lane];
+            if (!hit_anything) {
+                radiance += throughput * background;
+                break;
+            }
 
-        if (!world.hit(r, interval(0.001, infinity), rec))
-            return background;
+            scatter_record srec;
+            radiance += throughput * rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
 
-        scatter_record srec;
-        color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+            if (!rec.mat->scatter(r, rec, srec))
+                break;
 
-        if (!rec.mat->scatter(r, rec, srec))
-            return color_from_emission;
+            if (srec.skip_pdf) {
+                STAT_COUNT(skip_pdf_scatters);
+                throughput = throughput * srec.attenuation;
+                r = srec.skip_pdf_ray;
+            } else {
+                STAT_COUNT(pdf_scatters);
+                auto light_ptr = std::make_shared<hittable_pdf>(lights, rec.p);
+                mixture_pdf mixed_pdf(light_ptr, srec.pdf_ptr);
 
-        if (srec.skip_pdf)
-            return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, world, lights);
+                ray scattered = ray(rec.p, mixed_pdf.generate(), r.time());
+                double pdf_val = mixed_pdf.value(scattered.direction());
 
-        auto light_ptr = std::make_shared<hittable_pdf>(lights, rec.p);
-        mixture_pdf mixed_pdf(light_ptr, srec.pdf_ptr);
+                double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
 
-        ray scattered = ray(rec.p, mixed_pdf.generate(), r.time());
-        double pdf_val = mixed_pdf.value(scattered.direction());
+                throughput = throughput * srec.attenuation * scattering_pdf / pdf_val;
+                r = scattered;
+            }
 
-        double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+            if (bounce + 1 >= rr_start_depth) {
+                double survival = fmax(throughput.x(), fmax(throughput.y(), throughput.z()));
+                survival = interval(rr_min_survival, 1.0).clamp(survival);
+                if (sample_1d() >= survival) {
+                    STAT_COUNT(roulette_terminations);
+                    break;
+                }
+                throughput /= survival;
+            }
+        }
 
-        color sample_color = ray_color(scattered, depth - 1, world, lights);
-        color color_from_scatter = (srec.attenuation * scattering_pdf * sample_color) / pdf_val;
+        if (bounce == max_depth)
+            STAT_COUNT(max_depth_paths);
+        STAT_HISTOGRAM(path_bounces, std::min(bounce + 1, max_depth));
 
-        return color_from_emission + color_from_scatter;
+        return radiance;
     }
 };
 
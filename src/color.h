@@ -11,7 +11,20 @@ inline double linear_to_gamma(double linear_component) {
     return std::sqrt(linear_component);
 }
 
-void write_color(std::ostream& out, color pixel_color, int samples_per_pixel) {
+inline double luminance(const color& c) {
+    // Relative luminance of a linear color (Rec. 709 primaries).
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+inline color zero_nan(color c) {
+    // Zeroes NaN components of a single sample so they don't poison a pixel's sums.
+    for (int k = 0; k < 3; ++k)
+        if (c[k] != c[k]) c[k] = 0.0;
+    return c;
+}
+
+inline color resolve_color(color pixel_color, int samples_per_pixel) {
+    // Returns the mean of a pixel's summed samples, with NaN components replaced by zero.
     double r = pixel_color.x();
     double g = pixel_color.y();
     double b = pixel_color.z();
@@ -20,23 +33,25 @@ void write_color(std::ostream& out, color pixel_color, int samples_per_pixel) {
     if (r != r) r = 0.0;
     if (g != g) g = 0.0;
     if (b != b) b = 0.0;
-    
+
     // Divide the color by the number of samples.
-    double scale = 1.0 / samples_per_pixel;
-    r *= scale;
-    g *= scale;
-    b *= scale;
+    double scale = (samples_per_pixel > 0) ? 1.0 / samples_per_pixel : 0.0;
+    return color(r * scale, g * scale, b * scale);
+}
+
+inline int color_to_byte(double linear_component) {
+    // Apply the linear to gamma transform and translate to a [0, 255] value.
+    static const interval intensity(0.000, 0.999);
+    return static_cast<int>(256 * intensity.clamp(linear_to_gamma(linear_component)));
+}
 
-    // Apply the linear to gamma transform.
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
+void write_color(std::ostream& out, color pixel_color, int samples_per_pixel) {
+    color c = resolve_color(pixel_color, samples_per_pixel);
 
     // Write the translated [0, 255] value of each color componet.
-    static const interval intensity(0.000, 0.999);
-    out << static_cast<int>(256 * intensity.clamp(r)) << ' '
-        << static_cast<int>(256 * intensity.clamp(g)) << ' '
-        << static_cast<int>(256 * intensity.clamp(b)) << std::endl;
+    out << color_to_byte(c.x()) << ' '
+        << color_to_byte(c.y()) << ' '
+        << color_to_byte(c.z()) << '\n';
 }
 
 #endif // COLOR_H
\ No newline at end of file
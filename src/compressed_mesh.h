@@ -0,0 +1,122 @@
+#ifndef COMPRESSED_MESH_H
+#define COMPRESSED_MESH_H
+
+#include "rtweekend.h"
+
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+enum class mesh_storage {
+    full,    // Positions as doubles and indices as 32-bit integers, as loaded
+    float32, // Positions as floats relative to the center of the mesh's bounds
+    unorm16  // Positions as 16-bit steps across the mesh's bounds
+};
+
+class compressed_mesh {
+public:
+    // A mesh stored in less memory for very large scenes: positions as floats or 16-bit grid
+    // coordinates relative to the mesh's bounds, and indices in 16 bits when the mesh has few
+    // enough vertices. A vertex decodes to the same double wherever it is used, so triangles
+    // sharing an edge still share it exactly, and bounds computed from the decoded positions
+    // hold the decoded triangles.
+    //
+    // Positions move by up to half a float ulp relative to the bounds (float32), or half a
+    // 1/65535th of the bounds' extent per axis (unorm16). Indices take 6 bytes per triangle
+    // below 65536 vertices and 12 above; positions 12 or 6 bytes per vertex, against 24.
+    compressed_mesh() {}
+
+    compressed_mesh(const mesh& source, mesh_storage storage) : storage(storage) {
+        size_t n = source.vertex_count();
+        aabb bounds = aabb::empty;
+        for (size_t i = 0; i < n; ++i)
+            bounds = aabb(bounds, aabb(source.vertex(static_cast<int>(i)), source.vertex(static_cast<int>(i))));
+
+        if (storage == mesh_storage::unorm16) {
+            origin = point3(bounds.x.min, bounds.y.min, bounds.z.min);
+            for (int a = 0; a < 3; ++a) {
+                double extent = bounds.axis(a).size();
+                step[a] = (extent > 0) ? extent / 65535.0 : 0.0;
+            }
+            for (auto* q : { &qx, &qy, &qz })
+                q->resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                point3 p = source.vertex(static_cast<int>(i));
+                uint16_t* out[3] = { &qx[i], &qy[i], &qz[i] };
+                for (int a = 0; a < 3; ++a)
+                    *out[a] = (step[a] > 0) ? static_cast<uint16_t>(std::clamp(std::round((p[a] - origin[a]) / step[a]), 0.0, 65535.0)) : 0;
+            }
+        } else {
+            origin = point3((bounds.x.min + bounds.x.max) / 2, (bounds.y.min + bounds.y.max) / 2, (bounds.z.min + bounds.z.max) / 2);
+            for (auto* f : { &fx, &fy, &fz })
+                f->resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                vec3 offset = source.vertex(static_cast<int>(i)) - origin;
+                fx[i] = static_cast<float>(offset.x());
+                fy[i] = static_cast<float>(offset.y());
+                fz[i] = static_cast<float>(offset.z());
+            }
+        }
+
+        vertices = n;
+        if (n <= 65536)
+            short_indices.assign(source.indices.begin(), source.indices.end());
+        else
+            long_indices.assign(source.indices.begin(), source.indices.end());
+    }
+
+    mesh_storage format() const { return storage; }
+    size_t vertex_count() const { return vertices; }
+    size_t triangle_count() const { return (short_indices.size() + long_indices.size()) / 3; }
+
+    point3 vertex(int i) const {
+        if (storage == mesh_storage::unorm16)
+            return origin + vec3(qx[i] * step[0], qy[i] * step[1], qz[i] * step[2]);
+        return origin + vec3(fx[i], fy[i], fz[i]);
+    }
+
+    int index(size_t i) const {
+        return short_indices.empty() ? static_cast<int>(long_indices[i]) : static_cast<int>(short_indices[i]);
+    }
+
+    void triangle_vertices(int triangle, point3& v0, point3& v1, point3& v2) const {
+        v0 = vertex(index(3 * size_t(triangle)));
+        v1 = vertex(index(3 * size_t(triangle) + 1));
+        v2 = vertex(index(3 * size_t(triangle) + 2));
+    }
+
+    mesh decode() const {
+        // The decoded positions and indices as an ordinary mesh.
+        std::vector<double> x(vertices), y(vertices), z(vertices);
+        for (size_t i = 0; i < vertices; ++i) {
+            point3 p = vertex(static_cast<int>(i));
+            x[i] = p.x();
+            y[i] = p.y();
+            z[i] = p.z();
+        }
+        std::vector<int> indices(3 * triangle_count());
+        for (size_t i = 0; i < indices.size(); ++i)
+            indices[i] = index(i);
+        return mesh(std::move(x), std::move(y), std::move(z), std::move(indices));
+    }
+
+    size_t memory_bytes() const {
+        return (fx.size() + fy.size() + fz.size()) * sizeof(float) + (qx.size() + qy.size() + qz.size()) * sizeof(uint16_t)
+             + short_indices.size() * sizeof(uint16_t) + long_indices.size() * sizeof(uint32_t);
+    }
+
+private:
+    mesh_storage storage = mesh_storage::float32;
+    size_t vertices = 0;
+    point3 origin; // unorm16: minimum corner of the bounds. float32: their center
+    double step[3] = { 0, 0, 0 }; // unorm16: size of one grid step per axis
+    std::vector<float> fx, fy, fz;
+    std::vector<uint16_t> qx, qy, qz;
+    std::vector<uint16_t> short_indices; // Used if there are at most 65536 vertices
+    std::vector<uint32_t> long_indices; // Used otherwise
+};
+
+#endif // COMPRESSED_MESH_H
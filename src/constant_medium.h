@@ -41,7 +41,7 @@ public:
 
         double ray_length = r.direction().length();
         double distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-        double hit_distance = neg_inv_density * log(random_double());
+        double hit_distance = neg_inv_density * log(sample_1d());
 
         if (hit_distance > distance_inside_boundary)
             return false;
@@ -0,0 +1,241 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class film {
+public:
+    // Accumulates linear radiance for every pixel as a running sum plus a sample count, so the
+    // image can be averaged, written in HDR formats, or extended with more samples later.
+    film() : image_width(0), image_height(0) {}
+
+    film(int width, int height)
+        : image_width(width), image_height(height),
+          sums(3 * static_cast<size_t>(width) * height, 0.0f),
+          luminance_sq_sums(static_cast<size_t>(width) * height, 0.0f),
+          counts(static_cast<size_t>(width) * height, 0) {}
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+    int pixel_count() const { return image_width * image_height; }
+
+    void add(int i, int j, const color& sum, double luminance_sq_sum, int samples) {
+        // Adds the summed radiance of `samples` samples to pixel i, j, along with the sum of their
+        // squared luminances, which is what the pixel's variance estimate is built from.
+        size_t p = static_cast<size_t>(j) * image_width + i;
+        sums[3 * p + 0] += static_cast<float>(sum.x());
+        sums[3 * p + 1] += static_cast<float>(sum.y());
+        sums[3 * p + 2] += static_cast<float>(sum.z());
+        luminance_sq_sums[p] += static_cast<float>(luminance_sq_sum);
+        counts[p] += samples;
+    }
+
+    color pixel_sum(int p) const {
+        return color(sums[3 * p + 0], sums[3 * p + 1], sums[3 * p + 2]);
+    }
+
+    color pixel(int p) const {
+        // Returns the mean linear radiance of pixel p, with NaN components replaced by zero.
+        return resolve_color(pixel_sum(p), counts[p]);
+    }
+
+    int sample_count(int p) const { return static_cast<int>(counts[p]); }
+
+    double mean_luminance(int p) const {
+        return (counts[p] > 0) ? luminance(pixel_sum(p)) / counts[p] : 0.0;
+    }
+
+    double luminance_std_error(int p) const {
+        // Standard error of the pixel's mean luminance, from the sample variance.
+        double n = counts[p];
+        if (n < 2) return infinity;
+        double mean = mean_luminance(p);
+        double variance = fmax((luminance_sq_sums[p] - n * mean * mean) / (n - 1), 0.0);
+        return std::sqrt(variance / n);
+    }
+
+    long long total_samples() const {
+        long long total = 0;
+        for (uint32_t count : counts)
+            total += count;
+        return total;
+    }
+
+    bool write(const std::string& filename) const {
+        // Writes the image in the format given by the file extension: .pfm, .hdr, or binary .ppm.
+        std::string ext = extension(filename);
+        std::string data = (ext == "pfm") ? encode_pfm()
+                         : (ext == "hdr") ? encode_hdr()
+                                          : encode_ppm_binary();
+
+        std::ofstream out(filename, std::ios::binary);
+        if (!out.write(data.data(), data.size())) {
+            std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+    void write_ppm_ascii(std::ostream& out) const {
+        // Writes a plain (P3) PPM. The text is built in memory and handed to the stream in one write.
+        std::string data = "P3\n" + std::to_string(image_width) + ' ' + std::to_string(image_height) + "\n255\n";
+        data.reserve(data.size() + 12 * static_cast<size_t>(pixel_count()));
+        for (int p = 0; p < pixel_count(); ++p) {
+            color c = pixel(p);
+            data += std::to_string(color_to_byte(c.x())); data += ' ';
+            data += std::to_string(color_to_byte(c.y())); data += ' ';
+            data += std::to_string(color_to_byte(c.z())); data += '\n';
+        }
+        out.write(data.data(), data.size());
+        out.flush();
+    }
+
+    bool write_checkpoint(const std::string& filename, uint64_t seed) const {
+        // Saves the accumulation buffers together with the seed of the random streams that produced
+        // them. Since sample n of a pixel always uses the stream (seed, pixel, n), the seed and the
+        // per-pixel counts are all the random state needed to continue the render exactly. The
+        // file is written under a temporary name and then renamed over the previous checkpoint,
+        // which on POSIX replaces it atomically, so a crash at any point leaves either the old or
+        // the new checkpoint behind, never a truncated one or none. Returns false, keeping the
+        // previous checkpoint, if either step fails.
+        std::string temp_name = filename + ".tmp";
+        {
+            std::ofstream out(temp_name, std::ios::binary);
+            uint32_t header[4] = { checkpoint_magic, checkpoint_version,
+                                   static_cast<uint32_t>(image_width), static_cast<uint32_t>(image_height) };
+            out.write(reinterpret_cast<const char*>(header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(&seed), sizeof(seed));
+            out.write(reinterpret_cast<const char*>(sums.data()), sums.size() * sizeof(float));
+            out.write(reinterpret_cast<const char*>(luminance_sq_sums.data()), luminance_sq_sums.size() * sizeof(float));
+            out.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint32_t));
+            if (!out) {
+                std::cerr << "ERROR: Could not write checkpoint '" << temp_name << "'.\n";
+                return false;
+            }
+        }
+#if defined(_WIN32)
+        std::remove(filename.c_str()); // rename does not replace an existing file there
+#endif
+        if (std::rename(temp_name.c_str(), filename.c_str()) != 0) {
+            std::cerr << "ERROR: Could not replace checkpoint '" << filename << "'.\n";
+            std::remove(temp_name.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool read_checkpoint(const std::string& filename, uint64_t& seed) {
+        // Loads a checkpoint written by write_checkpoint(). Returns false, leaving the film
+        // untouched, if the file is missing or was written for a different image size.
+        std::ifstream in(filename, std::ios::binary);
+        uint32_t header[4];
+        uint64_t file_seed;
+        if (!in.read(reinterpret_cast<char*>(header), sizeof(header))
+            || !in.read(reinterpret_cast<char*>(&file_seed), sizeof(file_seed)))
+            return false;
+        if (header[0] != checkpoint_magic || header[1] != checkpoint_version
+            || header[2] != static_cast<uint32_t>(image_width) || header[3] != static_cast<uint32_t>(image_height))
+            return false;
+
+        film loaded(image_width, image_height);
+        in.read(reinterpret_cast<char*>(loaded.sums.data()), loaded.sums.size() * sizeof(float));
+        in.read(reinterpret_cast<char*>(loaded.luminance_sq_sums.data()), loaded.luminance_sq_sums.size() * sizeof(float));
+        in.read(reinterpret_cast<char*>(loaded.counts.data()), loaded.counts.size() * sizeof(uint32_t));
+        if (!in)
+            return false;
+
+        *this = std::move(loaded);
+        seed = file_seed;
+        return true;
+    }
+
+private:
+    static const uint32_t checkpoint_magic = 0x4b435452; // "RTCK"
+    static const uint32_t checkpoint_version = 1;
+
+    int image_width;
+    int image_height;
+    std::vector<float> sums; // Summed linear RGB radiance, three floats per pixel
+    std::vector<float> luminance_sq_sums; // Summed squared sample luminance per pixel
+    std::vector<uint32_t> counts; // Samples accumulated per pixel
+
+    static std::string extension(const std::string& filename) {
+        auto dot = filename.find_last_of('.');
+        if (dot == std::string::npos) return "";
+        std::string ext = filename.substr(dot + 1);
+        for (char& c : ext)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return ext;
+    }
+
+    std::string encode_ppm_binary() const {
+        // Binary (P6) PPM with gamma-corrected 8-bit components.
+        std::string data = "P6\n" + std::to_string(image_width) + ' ' + std::to_string(image_height) + "\n255\n";
+        size_t offset = data.size();
+        data.resize(offset + 3 * static_cast<size_t>(pixel_count()));
+        for (int p = 0; p < pixel_count(); ++p) {
+            color c = pixel(p);
+            data[offset++] = static_cast<char>(color_to_byte(c.x()));
+            data[offset++] = static_cast<char>(color_to_byte(c.y()));
+            data[offset++] = static_cast<char>(color_to_byte(c.z()));
+        }
+        return data;
+    }
+
+    std::string encode_pfm() const {
+        // Portable float map: linear 32-bit RGB, little endian (negative scale), rows bottom to top.
+        std::string data = "PF\n" + std::to_string(image_width) + ' ' + std::to_string(image_height) + "\n-1.0\n";
+        size_t offset = data.size();
+        data.resize(offset + 3 * sizeof(float) * pixel_count());
+        for (int j = image_height - 1; j >= 0; --j) {
+            for (int i = 0; i < image_width; ++i) {
+                color c = pixel(j * image_width + i);
+                float rgb[3] = { static_cast<float>(c.x()), static_cast<float>(c.y()), static_cast<float>(c.z()) };
+                for (float f : rgb) {
+                    uint32_t bits;
+                    std::memcpy(&bits, &f, sizeof(bits));
+                    for (int b = 0; b < 4; ++b)
+                        data[offset++] = static_cast<char>((bits >> (8 * b)) & 0xff);
+                }
+            }
+        }
+        return data;
+    }
+
+    std::string encode_hdr() const {
+        // Radiance RGBE with flat (uncompressed) scanlines, top to bottom.
+        std::string data = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(image_height)
+                         + " +X " + std::to_string(image_width) + "\n";
+        size_t offset = data.size();
+        data.resize(offset + 4 * static_cast<size_t>(pixel_count()));
+        for (int p = 0; p < pixel_count(); ++p) {
+            color c = pixel(p);
+            double r = fmax(c.x(), 0.0), g = fmax(c.y(), 0.0), b = fmax(c.z(), 0.0);
+            double v = fmax(r, fmax(g, b));
+            unsigned char rgbe[4] = { 0, 0, 0, 0 };
+            if (v >= 1e-32) {
+                int e;
+                double scale = frexp(v, &e) * 256.0 / v;
+                rgbe[0] = static_cast<unsigned char>(r * scale);
+                rgbe[1] = static_cast<unsigned char>(g * scale);
+                rgbe[2] = static_cast<unsigned char>(b * scale);
+                rgbe[3] = static_cast<unsigned char>(e + 128);
+            }
+            for (unsigned char byte : rgbe)
+                data[offset++] = static_cast<char>(byte);
+        }
+        return data;
+    }
+};
+
+#endif // FILM_H
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "rtweekend.h"
 
 #include "aabb.h"
+#include "packet.h"
 
 class material;
 
@@ -26,14 +27,53 @@ public:
     }
 };
 
+class packet_hits {
+public:
+    // Closest hit found so far for every lane of a ray packet.
+    double t[packet_size]; // Hit distance, or the lane's initial t_max while it has no hit
+    hit_record rec[packet_size];
+    uint32_t hit_mask = 0; // Lanes with a hit
+    uint32_t updated = 0; // Lanes whose record was written; wrappers use it to find their own hits
+
+    void reset(double t_max) {
+        for (int l = 0; l < packet_size; ++l)
+            t[l] = t_max;
+        hit_mask = updated = 0;
+    }
+
+    void record(int lane, const hit_record& hit) {
+        rec[lane] = hit;
+        t[lane] = hit.t;
+        hit_mask |= 1u << lane;
+        updated |= 1u << lane;
+    }
+};
+
 class hittable {
 public:
     virtual ~hittable() = default;
 
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
+    virtual void hit_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const {
+        // Intersects the active lanes of a packet, keeping each lane's closest hit. Objects without
+        // a packet path fall back to tracing the lanes one by one.
+        for (int l = 0; l < packet_size; ++l) {
+            if (!(active & (1u << l))) continue;
+            hit_record rec;
+            if (hit(packet.lane_ray(l), interval(t_min, hits.t[l]), rec))
+                hits.record(l, rec);
+        }
+    }
+
     virtual aabb bounding_box() const = 0;
 
+    virtual aabb clipped_bounding_box(const aabb& box) const {
+        // Bounds of the part of the object inside `box`, used by spatial BVH splits. Objects that
+        // cannot clip themselves more tightly return the overlap of the two boxes.
+        return overlap(bounding_box(), box);
+    }
+
     virtual double pdf_value(const point3& origin, const vec3& v) const {
         return 0.0;
     }
@@ -65,6 +105,27 @@ public:
         return true;
     }
 
+    void hit_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const override {
+        ray_packet offset_packet = packet;
+        for (int l = 0; l < packet_size; ++l) {
+            offset_packet.ox[l] -= offset.x();
+            offset_packet.oy[l] -= offset.y();
+            offset_packet.oz[l] -= offset.z();
+        }
+        for (int a = 0; a < 3; ++a) {
+            offset_packet.origin_min[a] -= offset[a];
+            offset_packet.origin_max[a] -= offset[a];
+        }
+
+        uint32_t outer_updated = hits.updated;
+        hits.updated = 0;
+        object->hit_packet(offset_packet, active, t_min, hits);
+        for (int l = 0; l < packet_size; ++l)
+            if (hits.updated & (1u << l))
+                hits.rec[l].p += offset;
+        hits.updated |= outer_updated;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
 private:
@@ -234,6 +295,29 @@ public:
         return true;
     }
 
+    void hit_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const override {
+        ray_packet rotated = packet;
+        for (int l = 0; l < packet_size; ++l) {
+            if (!(active & (1u << l))) continue;
+            ray lane = packet.lane_ray(l);
+            point3 origin = lane.origin();
+            vec3 direction = lane.direction();
+            rotated.set(l, ray(invtransform(origin), invtransform(direction), lane.time()));
+        }
+        rotated.finalize(active);
+
+        uint32_t outer_updated = hits.updated;
+        hits.updated = 0;
+        ptr->hit_packet(rotated, active, t_min, hits);
+        for (int l = 0; l < packet_size; ++l) {
+            if (!(hits.updated & (1u << l))) continue;
+            hit_record& rec = hits.rec[l];
+            rec.p = transform(rec.p);
+            rec.set_face_normal(rotated.lane_ray(l), transform(rec.normal));
+        }
+        hits.updated |= outer_updated;
+    }
+
     virtual aabb bounding_box() const override {
         return bbox;
     }
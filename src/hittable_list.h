@@ -4,6 +4,7 @@
 #include "hittable.h"
 #include "aabb.h"
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -44,6 +45,11 @@ public:
         return hit_anything;
     }
 
+    void hit_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const override {
+        for (const auto& object : objects)
+            object->hit_packet(packet, active, t_min, hits);
+    }
+
     aabb bounding_box() const override { return bbox; }
 
     double pdf_value(const point3& origin, const vec3& v) const override {
@@ -58,7 +64,8 @@ public:
 
     vec3 random(const vec3& origin) const override {
         auto int_size = static_cast<int>(objects.size());
-        return objects[random_int(0, int_size - 1)]->random(origin);
+        int index = std::min(static_cast<int>(sample_1d() * int_size), int_size - 1);
+        return objects[index]->random(origin);
     }
 
 private:
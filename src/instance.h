@@ -0,0 +1,174 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+
+class affine_transform {
+public:
+    // p' = linear * p + offset: a 3x3 matrix, stored by rows, followed by a translation.
+    double linear[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    vec3 offset = vec3(0, 0, 0);
+
+    static affine_transform translation(const vec3& displacement) {
+        affine_transform t;
+        t.offset = displacement;
+        return t;
+    }
+
+    static affine_transform rotation(double ax, double ay, double az) {
+        // Rotation by the given angles in degrees about x, then y, then z, as rotate_ applies them.
+        ax = degrees_to_radians(ax); ay = degrees_to_radians(ay); az = degrees_to_radians(az);
+        double sx = sin(ax), cx = cos(ax), sy = sin(ay), cy = cos(ay), sz = sin(az), cz = cos(az);
+        affine_transform rx, ry, rz;
+        rx.set_linear(1, 0, 0, 0, cx, sx, 0, -sx, cx);
+        ry.set_linear(cy, 0, sy, 0, 1, 0, -sy, 0, cy);
+        rz.set_linear(cz, sz, 0, -sz, cz, 0, 0, 0, 1);
+        return rz * ry * rx;
+    }
+
+    static affine_transform scaling(double s) {
+        affine_transform t;
+        t.set_linear(s, 0, 0, 0, s, 0, 0, 0, s);
+        return t;
+    }
+
+    affine_transform operator*(const affine_transform& b) const {
+        // The transform that applies b first, then this one.
+        affine_transform c;
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                c.linear[i][j] = linear[i][0] * b.linear[0][j] + linear[i][1] * b.linear[1][j] + linear[i][2] * b.linear[2][j];
+        c.offset = vector(b.offset) + offset;
+        return c;
+    }
+
+    affine_transform inverse() const {
+        // Inverts the linear part by its adjugate; the transform must not be singular.
+        const double (&m)[3][3] = linear;
+        affine_transform inv;
+        inv.linear[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        inv.linear[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+        inv.linear[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+        inv.linear[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        inv.linear[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+        inv.linear[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+        inv.linear[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        inv.linear[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+        inv.linear[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+        double det = m[0][0] * inv.linear[0][0] + m[0][1] * inv.linear[1][0] + m[0][2] * inv.linear[2][0];
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                inv.linear[i][j] /= det;
+        inv.offset = -inv.vector(offset);
+        return inv;
+    }
+
+    point3 point(const point3& p) const { return vector(p) + offset; }
+
+    vec3 vector(const vec3& v) const {
+        return vec3(linear[0][0] * v.x() + linear[0][1] * v.y() + linear[0][2] * v.z(),
+                    linear[1][0] * v.x() + linear[1][1] * v.y() + linear[1][2] * v.z(),
+                    linear[2][0] * v.x() + linear[2][1] * v.y() + linear[2][2] * v.z());
+    }
+
+    vec3 transposed_vector(const vec3& v) const {
+        // Applies the transpose of the linear part. Normals map by the inverse transpose, so the
+        // inverse transform's transposed_vector carries normals forward.
+        return vec3(linear[0][0] * v.x() + linear[1][0] * v.y() + linear[2][0] * v.z(),
+                    linear[0][1] * v.x() + linear[1][1] * v.y() + linear[2][1] * v.z(),
+                    linear[0][2] * v.x() + linear[1][2] * v.y() + linear[2][2] * v.z());
+    }
+
+    aabb box(const aabb& b) const {
+        // Bounds of the transformed corners of a box.
+        if (b.x.size() < 0 || b.y.size() < 0 || b.z.size() < 0)
+            return aabb::empty;
+        point3 min(infinity, infinity, infinity);
+        point3 max(-infinity, -infinity, -infinity);
+        for (int i = 0; i < 2; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                for (int k = 0; k < 2; ++k) {
+                    point3 corner = point(point3(i ? b.x.max : b.x.min, j ? b.y.max : b.y.min, k ? b.z.max : b.z.min));
+                    for (int c = 0; c < 3; ++c) {
+                        min[c] = fmin(min[c], corner[c]);
+                        max[c] = fmax(max[c], corner[c]);
+                    }
+                }
+            }
+        }
+        return aabb(min, max);
+    }
+
+private:
+    void set_linear(double a, double b, double c, double d, double e, double f, double g, double h, double i) {
+        linear[0][0] = a; linear[0][1] = b; linear[0][2] = c;
+        linear[1][0] = d; linear[1][1] = e; linear[1][2] = f;
+        linear[2][0] = g; linear[2][1] = h; linear[2][2] = i;
+    }
+};
+
+class instance : public hittable {
+public:
+    // A placement of a shared object (typically a mesh with its own BVH, built in object space)
+    // under an affine transform. Any number of instances can share one object, so each copy
+    // costs only this record; the scene BVH is then built over the instances.
+    instance(std::shared_ptr<hittable> object, const affine_transform& object_to_world)
+        : object(object), to_world(object_to_world), to_object(object_to_world.inverse())
+    {
+        bbox = to_world.box(object->bounding_box());
+    }
+
+    void set_transform(const affine_transform& object_to_world) {
+        // Moves the instance; a BVH holding it must be refit before it is traced again.
+        to_world = object_to_world;
+        to_object = object_to_world.inverse();
+        bbox = to_world.box(object->bounding_box());
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // The object-space ray keeps the same parameterization, so t needs no conversion.
+        ray object_ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+        if (!object->hit(object_ray, ray_t, rec))
+            return false;
+
+        to_world_space(rec);
+        return true;
+    }
+
+    void hit_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const override {
+        ray_packet object_packet = packet;
+        for (int l = 0; l < packet_size; ++l) {
+            if (!(active & (1u << l))) continue;
+            ray lane = packet.lane_ray(l);
+            object_packet.set(l, ray(to_object.point(lane.origin()), to_object.vector(lane.direction()), lane.time()));
+        }
+        object_packet.finalize(active);
+
+        uint32_t outer_updated = hits.updated;
+        hits.updated = 0;
+        object->hit_packet(object_packet, active, t_min, hits);
+        for (int l = 0; l < packet_size; ++l)
+            if (hits.updated & (1u << l))
+                to_world_space(hits.rec[l]);
+        hits.updated |= outer_updated;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    std::shared_ptr<hittable> object;
+    affine_transform to_world;
+    affine_transform to_object;
+    aabb bbox;
+
+    void to_world_space(hit_record& rec) const {
+        // Moves a hit from object space to world space. Dot products between directions and
+        // normals keep their sign under the transform, so front_face still holds.
+        rec.p = to_world.point(rec.p);
+        rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+    }
+};
+
+#endif // INSTANCE_H
@@ -0,0 +1,258 @@
+#ifndef LBVH_BUILD_H
+#define LBVH_BUILD_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "bvh_build.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+inline uint64_t spread_bits_3(uint64_t x) {
+    // Spreads the low 21 bits of x so that two zero bits follow each one (bit i moves to bit 3i).
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+inline uint64_t morton_code(uint64_t x, uint64_t y, uint64_t z) {
+    // Interleaves the coordinates' bits as ...xyzxyz, so bit b of the code splits along axis 2 - b % 3.
+    return (spread_bits_3(x) << 2) | (spread_bits_3(y) << 1) | spread_bits_3(z);
+}
+
+class lbvh_builder {
+public:
+    // Builds a BVH from the Morton order of the primitive centroids. The codes are radix sorted,
+    // then every run of primitives sharing the leading treelet_bits becomes a treelet, built by
+    // splitting where the next code bit changes. The treelets are built in parallel and joined
+    // either the same way (LBVH) or by a binned SAH build over their bounds (HLBVH). Sorting is
+    // stable and every split depends only on the codes, so the tree is the same for any number
+    // of threads.
+    lbvh_builder(const std::vector<aabb>& bounds, const bvh_build_options& options)
+        : bounds(bounds), options(options) {
+        this->options.max_leaf_size = std::clamp(this->options.max_leaf_size, 1, bvh_max_leaf_size);
+        this->options.morton_bits = (options.morton_bits > 30) ? 63 : 30;
+        this->options.treelet_bits = std::clamp(options.treelet_bits, 0, this->options.morton_bits);
+    }
+
+    bvh_build_result build() {
+        bvh_build_result tree;
+        int n = static_cast<int>(bounds.size());
+        if (n > 0) {
+            sort_primitives();
+            tree.order.resize(n);
+            for (int i = 0; i < n; ++i)
+                tree.order[i] = primitives[i].index;
+
+            // Cut the sorted codes into treelets and build each on its own.
+            int low_bits = options.morton_bits - options.treelet_bits;
+            std::vector<bvh_subtree> treelets;
+            for (int i = 0; i < n; ++i) {
+                if (i == 0 || (primitives[i].code >> low_bits) != (primitives[i - 1].code >> low_bits))
+                    treelets.push_back({ i, i, {} });
+                treelets.back().end = i + 1;
+            }
+            parallel_for(static_cast<int>(treelets.size()), options.build_threads, [&](int t, int) {
+                bvh_subtree& treelet = treelets[t];
+                treelet.nodes.reserve(2 * static_cast<size_t>(treelet.end - treelet.first));
+                emit(treelet.nodes, treelet.first, treelet.end, low_bits - 1);
+            });
+
+            std::vector<bvh_build_node> top;
+            if (options.split == bvh_split_method::hlbvh)
+                build_top_sah(top, treelets);
+            else
+                emit_top(top, treelets, 0, static_cast<int>(treelets.size()), options.morton_bits - 1, low_bits);
+
+            tree.nodes.reserve(2 * static_cast<size_t>(n));
+            stitch_subtrees(tree.nodes, top, treelets, 0);
+        }
+        measure_bvh(tree, options);
+        return tree;
+    }
+
+private:
+    struct morton_primitive {
+        uint64_t code;
+        int index;
+    };
+
+    static const int chunk_size = 16384; // Primitives per chunk of the parallel passes
+
+    const std::vector<aabb>& bounds;
+    bvh_build_options options;
+    std::vector<morton_primitive> primitives; // In Morton order once sorted
+
+    void sort_primitives() {
+        // Quantizes every centroid to the grid over the centroid bounds and sorts by Morton code.
+        int n = static_cast<int>(bounds.size());
+        int axis_bits = options.morton_bits / 3;
+        double cells = static_cast<double>(1ull << axis_bits);
+
+        interval centroid_bounds[3] = { interval::empty, interval::empty, interval::empty };
+        for (const aabb& b : bounds) {
+            point3 c = centroid(b);
+            for (int a = 0; a < 3; ++a)
+                centroid_bounds[a] = interval(centroid_bounds[a], interval(c[a], c[a]));
+        }
+
+        primitives.resize(n);
+        parallel_chunks(0, n, chunk_size, options.build_threads, [&](int, int from, int to) {
+            for (int i = from; i < to; ++i) {
+                point3 c = centroid(bounds[i]);
+                uint64_t q[3];
+                for (int a = 0; a < 3; ++a) {
+                    double extent = centroid_bounds[a].size();
+                    double t = (extent > 0) ? (c[a] - centroid_bounds[a].min) / extent : 0.0;
+                    q[a] = static_cast<uint64_t>(std::clamp(t * cells, 0.0, cells - 1));
+                }
+                primitives[i] = { morton_code(q[0], q[1], q[2]), i };
+            }
+        });
+        radix_sort();
+    }
+
+    void radix_sort() {
+        // Stable least-significant-digit radix sort, 8 bits per pass. Each pass counts the digits
+        // of every chunk in parallel, turns the counts into per-chunk output offsets, and then
+        // scatters the chunks in parallel.
+        const int radix = 256;
+        int n = static_cast<int>(primitives.size());
+        int chunks = (n + chunk_size - 1) / chunk_size;
+        std::vector<morton_primitive> scratch(n);
+        std::vector<int> offsets(static_cast<size_t>(chunks) * radix);
+
+        for (int shift = 0; shift < options.morton_bits; shift += 8) {
+            parallel_chunks(0, n, chunk_size, options.build_threads, [&](int c, int from, int to) {
+                int* count = offsets.data() + static_cast<size_t>(c) * radix;
+                std::fill(count, count + radix, 0);
+                for (int i = from; i < to; ++i)
+                    ++count[(primitives[i].code >> shift) & (radix - 1)];
+            });
+
+            int position = 0;
+            for (int digit = 0; digit < radix; ++digit) {
+                for (int c = 0; c < chunks; ++c) {
+                    int& slot = offsets[static_cast<size_t>(c) * radix + digit];
+                    int count = slot;
+                    slot = position;
+                    position += count;
+                }
+            }
+
+            parallel_chunks(0, n, chunk_size, options.build_threads, [&](int c, int from, int to) {
+                int* next = offsets.data() + static_cast<size_t>(c) * radix;
+                for (int i = from; i < to; ++i)
+                    scratch[next[(primitives[i].code >> shift) & (radix - 1)]++] = primitives[i];
+            });
+            primitives.swap(scratch);
+        }
+    }
+
+    static int split_axis(int bit) { return 2 - bit % 3; }
+
+    template <typename Key>
+    static int find_split(int first, int end, int& bit, int lowest_bit, const Key& key) {
+        // Lowers `bit` to the highest bit at which the sorted keys of [first, end) differ and
+        // returns the first index with that bit set, or `end` if no bit down to lowest_bit differs.
+        for (; bit >= lowest_bit; --bit) {
+            uint64_t mask = 1ull << bit;
+            if ((key(first) & mask) == (key(end - 1) & mask))
+                continue;
+            int lo = first, hi = end - 1; // key(lo) has the bit clear, key(hi) has it set
+            while (hi - lo > 1) {
+                int mid = lo + (hi - lo) / 2;
+                if (key(mid) & mask) hi = mid; else lo = mid;
+            }
+            return hi;
+        }
+        return end;
+    }
+
+    int emit(std::vector<bvh_build_node>& nodes, int first, int end, int bit) {
+        // Builds the node over primitives[first, end), whose codes agree above `bit`.
+        int index = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+        int count = end - first;
+        if (count <= options.max_leaf_size) {
+            aabb box = aabb::empty;
+            for (int i = first; i < end; ++i)
+                box = aabb(box, bounds[primitives[i].index]);
+            nodes[index].bbox = box;
+            nodes[index].first = first;
+            nodes[index].count = count;
+            return index;
+        }
+
+        int mid = find_split(first, end, bit, 0, [this](int i) { return primitives[i].code; });
+        int axis = 0;
+        if (mid == end)
+            mid = first + count / 2; // Identical codes: split the range in half
+        else
+            axis = split_axis(bit);
+
+        nodes[index].axis = axis;
+        int left = emit(nodes, first, mid, bit - 1);
+        int right = emit(nodes, mid, end, bit - 1);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        nodes[index].bbox = aabb(nodes[left].bbox, nodes[right].bbox);
+        return index;
+    }
+
+    int emit_top(std::vector<bvh_build_node>& nodes, const std::vector<bvh_subtree>& treelets,
+                 int first, int end, int bit, int low_bits) {
+        // Builds the levels above treelets[first, end) by their leading code bits, down to single
+        // treelets, which are left as placeholders.
+        int index = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+        if (end - first == 1) {
+            nodes[index].bbox = treelets[first].nodes[0].bbox;
+            nodes[index].count = -1;
+            nodes[index].first = first;
+            return index;
+        }
+
+        int mid = find_split(first, end, bit, low_bits,
+            [&](int t) { return primitives[treelets[t].first].code; });
+        if (mid == end)
+            mid = first + (end - first) / 2;
+        nodes[index].axis = split_axis(bit);
+        int left = emit_top(nodes, treelets, first, mid, bit - 1, low_bits);
+        int right = emit_top(nodes, treelets, mid, end, bit - 1, low_bits);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        nodes[index].bbox = aabb(nodes[left].bbox, nodes[right].bbox);
+        return index;
+    }
+
+    void build_top_sah(std::vector<bvh_build_node>& top, const std::vector<bvh_subtree>& treelets) {
+        // Builds the levels above the treelets with the binned SAH builder, one treelet per leaf.
+        std::vector<aabb> treelet_bounds;
+        treelet_bounds.reserve(treelets.size());
+        for (const bvh_subtree& treelet : treelets)
+            treelet_bounds.push_back(treelet.nodes[0].bbox);
+
+        bvh_build_options top_options = options;
+        top_options.split = bvh_split_method::sah;
+        top_options.max_leaf_size = 1;
+        bvh_build_result top_tree = bvh_builder(treelet_bounds, top_options).build();
+
+        top = std::move(top_tree.nodes);
+        for (bvh_build_node& node : top) {
+            if (node.count > 0) {
+                node.first = top_tree.order[node.first];
+                node.count = -1;
+            }
+        }
+    }
+};
+
+#endif // LBVH_BUILD_H
@@ -0,0 +1,126 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+class mapped_file {
+public:
+    // A whole file mapped read-only into memory. The pages belong to the operating system's file
+    // cache, so every process that maps the same file shares them.
+    static std::shared_ptr<mapped_file> open(const std::string& path) {
+        // Returns null if the file cannot be opened or mapped.
+        std::shared_ptr<mapped_file> file(new mapped_file());
+        return file->map(path) ? file : nullptr;
+    }
+
+    ~mapped_file() {
+#if defined(_WIN32)
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#if defined(_WIN32)
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    mapped_file() {}
+
+    bool map(const std::string& path) {
+#if defined(_WIN32)
+        handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0)
+            return false;
+        mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return false;
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(file_size.QuadPart);
+        return bytes != nullptr;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED)
+            return false;
+        bytes = static_cast<const char*>(address);
+        length = static_cast<size_t>(info.st_size);
+        return true;
+#endif
+    }
+};
+
+template <typename T>
+class shared_array {
+public:
+    // A read-only array that either owns its elements or views memory owned by something else,
+    // such as a mapped cache file, which it keeps alive. Copies share the elements.
+    shared_array() {}
+
+    shared_array(std::vector<T> elements) {
+        auto owned = std::make_shared<const std::vector<T>>(std::move(elements));
+        first = owned->data();
+        count = owned->size();
+        owner = std::move(owned);
+    }
+
+    shared_array(const T* elements, size_t size, std::shared_ptr<const void> keep_alive)
+        : first(elements), count(size), owner(std::move(keep_alive)) {}
+
+    const T& operator[](size_t i) const { return first[i]; }
+    const T* data() const { return first; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T* begin() const { return first; }
+    const T* end() const { return first + count; }
+
+    std::vector<T> to_vector() const { return std::vector<T>(begin(), end()); }
+
+private:
+    const T* first = nullptr;
+    size_t count = 0;
+    std::shared_ptr<const void> owner;
+};
+
+#endif // MAPPED_FILE_H
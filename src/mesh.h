@@ -0,0 +1,50 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "rtweekend.h"
+
+#include "mapped_file.h"
+
+#include <vector>
+
+struct mesh {
+    // Triangles of a loaded mesh: vertex positions as separate x, y and z arrays (structure of
+    // arrays), and three vertex indices per triangle. The buffers are either owned or views into
+    // a mapped mesh cache, and copies of a mesh share them.
+    mesh() {}
+
+    mesh(shared_array<double> x, shared_array<double> y, shared_array<double> z, shared_array<int> indices)
+        : x(std::move(x)), y(std::move(y)), z(std::move(z)), indices(std::move(indices)) {}
+
+    shared_array<double> x, y, z;
+    shared_array<int> indices;
+
+    size_t vertex_count() const { return x.size(); }
+    size_t triangle_count() const { return indices.size() / 3; }
+    point3 vertex(int i) const { return point3(x[i], y[i], z[i]); }
+
+    void triangle_vertices(int triangle, point3& v0, point3& v1, point3& v2) const {
+        v0 = vertex(indices[3 * triangle]);
+        v1 = vertex(indices[3 * triangle + 1]);
+        v2 = vertex(indices[3 * triangle + 2]);
+    }
+};
+
+inline mesh merge_meshes(const std::vector<mesh>& meshes) {
+    // One mesh holding the triangles of all the given meshes; a single mesh is shared as it is.
+    if (meshes.size() == 1)
+        return meshes[0];
+    std::vector<double> x, y, z;
+    std::vector<int> indices;
+    for (const mesh& m : meshes) {
+        int base = static_cast<int>(x.size());
+        x.insert(x.end(), m.x.begin(), m.x.end());
+        y.insert(y.end(), m.y.begin(), m.y.end());
+        z.insert(z.end(), m.z.begin(), m.z.end());
+        for (int index : m.indices)
+            indices.push_back(base + index);
+    }
+    return mesh(std::move(x), std::move(y), std::move(z), std::move(indices));
+}
+
+#endif // MESH_H
@@ -0,0 +1,421 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "mapped_file.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <process.h>
+#endif
+
+// A binary cache of a model's preprocessed meshes and its flattened BVH, stored next to the
+// source file. The file is mapped and its buffers used in place, so loading a cached model
+// reads no text and builds nothing, and processes rendering the same model share its pages.
+// The name carries a key hashed from the source file's path, size and modification time, the
+// model's scale, which reader imported it, whether its meshes were preprocessed, and the BVH
+// options, so a changed model or build setting never reads a stale cache. The source's size and
+// time are also stored in the file and compared exactly on load.
+
+const uint32_t mesh_cache_version = 6; // Raise when the layout of any cached structure changes
+
+struct mesh_cache_id {
+    uint64_t key = 0; // Names the cache file
+    uint64_t source_size = 0; // Size of the source file
+    int64_t source_time = 0; // Modification time of the source file, in ticks of its clock
+};
+
+struct mesh_cache_contents {
+    std::vector<mesh> meshes;
+    bool has_bvh = false;
+    bvh_layout bvh;
+};
+
+class mesh_cache_hash {
+  public:
+    // 64-bit FNV-1a.
+    void add(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            value ^= bytes[i];
+            value *= 0x100000001b3ull;
+        }
+    }
+
+    template <typename T>
+    void add(const T& field) { add(&field, sizeof(field)); }
+
+    uint64_t result() const { return value; }
+
+  private:
+    uint64_t value = 0xcbf29ce484222325ull;
+};
+
+inline bool mesh_cache_key(const std::string& source_path, double scale, bool obj_reader, bool preprocessed,
+                           const bvh_build_options& options, mesh_cache_id& id) {
+    // False if the source file cannot be found. The source is known by its size and modification
+    // time rather than its contents, so a cached load reads none of it. obj_reader tells whether
+    // read_obj or Assimp imports it, since their positions differ in the last bits. The thread
+    // count is left out: it does not change the tree.
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(source_path, error);
+    if (error)
+        return false;
+    auto time = std::filesystem::last_write_time(source_path, error);
+    if (error)
+        return false;
+    id.source_size = static_cast<uint64_t>(size);
+    id.source_time = static_cast<int64_t>(time.time_since_epoch().count());
+
+    mesh_cache_hash hash;
+    hash.add(source_path.data(), source_path.size());
+    hash.add(id.source_size);
+    hash.add(id.source_time);
+    hash.add(mesh_cache_version);
+    hash.add(scale);
+    hash.add(obj_reader);
+    hash.add(preprocessed);
+    hash.add(static_cast<int>(options.split));
+    hash.add(options.sah_bins);
+    hash.add(options.max_leaf_size);
+    hash.add(options.traversal_cost);
+    hash.add(options.morton_bits);
+    hash.add(options.treelet_bits);
+    hash.add(options.width);
+    hash.add(options.sbvh_max_growth);
+    hash.add(options.sbvh_overlap);
+    id.key = hash.result();
+    return true;
+}
+
+inline std::string mesh_cache_path(const std::string& source_path, uint64_t key) {
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(key));
+    return source_path + "." + hex + ".rtcache";
+}
+
+namespace mesh_cache_detail {
+    const char magic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 0, 0 };
+    const uint32_t byte_order_mark = 0x01020304; // Reads differently on a machine of the other byte order
+    const uint64_t alignment = 64; // Sections start at multiples of this, so mapped nodes keep their alignment
+
+    enum section_kind : uint32_t {
+        positions_x = 1, positions_y = 2, positions_z = 3, indices = 4, // Per mesh, in this order
+        bvh_info = 5, bvh_nodes = 6, bvh_order = 7
+    };
+
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t key;
+        uint64_t source_size;
+        int64_t source_time;
+        uint32_t section_count;
+        uint32_t reserved;
+    };
+
+    struct section {
+        uint32_t kind;
+        uint32_t element_size; // Checked on load, so a build with a different node layout misses
+        uint64_t offset; // From the start of the file
+        uint64_t count;
+    };
+
+    struct bvh_info_record {
+        int32_t width;
+        int32_t depth;
+        double bbox[6]; // Min x, y, z, then max x, y, z
+        double sah_cost;
+        int32_t quality_depth;
+        int32_t node_count;
+        int32_t leaf_count;
+        int32_t reserved;
+        double duplication;
+    };
+
+    struct pending_section {
+        uint32_t kind;
+        uint32_t element_size;
+        const void* data;
+        uint64_t count;
+    };
+
+    template <typename T>
+    pending_section pending(section_kind kind, const shared_array<T>& elements) {
+        return { kind, static_cast<uint32_t>(sizeof(T)), elements.data(), elements.size() };
+    }
+
+    template <typename T>
+    shared_array<T> view(const std::shared_ptr<mapped_file>& file, const section& s) {
+        return shared_array<T>(reinterpret_cast<const T*>(file->data() + s.offset), static_cast<size_t>(s.count), file);
+    }
+
+    // A mapped tree is trusted only if every child lies after its parent, every leaf inside the
+    // primitive order and every unused slot has the empty box no ray enters, so traversal can
+    // neither loop nor read outside the file, and no path is longer than the recorded depth that
+    // sizes the traversal stacks.
+    inline bool valid_tree(const linear_bvh& tree) {
+        size_t n = tree.nodes.size();
+        std::vector<int> levels(n, 1);
+        for (size_t i = n; i-- > 0;) {
+            const linear_bvh_node& node = tree.nodes[i];
+            if (node.is_leaf()) {
+                if (uint64_t(node.offset) + node.count > tree.order.size())
+                    return false;
+            } else {
+                if (i + 2 >= n || node.offset <= i + 1 || node.offset >= n)
+                    return false;
+                levels[i] = 1 + std::max(levels[i + 1], levels[node.offset]);
+            }
+        }
+        return n == 0 || levels[0] <= tree.depth;
+    }
+
+    template <int N>
+    bool valid_tree(const wide_bvh<N>& tree) {
+        size_t n = tree.nodes.size();
+        std::vector<int> levels(n, 1);
+        for (size_t i = n; i-- > 0;) {
+            const wide_bvh_node<N>& node = tree.nodes[i];
+            for (int slot = 0; slot < N; ++slot) {
+                if (node.count[slot] > 0) {
+                    if (uint64_t(node.child[slot]) + node.count[slot] > tree.order.size())
+                        return false;
+                } else if (node.child[slot] != 0) {
+                    if (node.child[slot] <= i || node.child[slot] >= n)
+                        return false;
+                    levels[i] = std::max(levels[i], 1 + levels[node.child[slot]]);
+                } else {
+                    for (int a = 0; a < 3; ++a)
+                        if (node.bounds[a][slot] != infinity || node.bounds[a + 3][slot] != -infinity)
+                            return false;
+                }
+            }
+        }
+        return n == 0 || levels[0] <= tree.depth;
+    }
+
+    inline bool valid_mesh(const mesh& m) {
+        size_t vertices = m.x.size();
+        if (m.y.size() != vertices || m.z.size() != vertices || m.indices.size() % 3 != 0)
+            return false;
+        for (size_t i = 0; i < m.indices.size(); ++i)
+            if (m.indices[i] < 0 || static_cast<size_t>(m.indices[i]) >= vertices)
+                return false;
+        return true;
+    }
+
+    inline long long process_id() {
+#if defined(_WIN32)
+        return _getpid();
+#else
+        return getpid();
+#endif
+    }
+}
+
+inline bool read_mesh_cache(const std::string& path, const mesh_cache_id& id, mesh_cache_contents& contents) {
+    // Maps a cache file and points the meshes and BVH at its sections. False if the file is
+    // missing, was written for another key, source, version or byte order, or is malformed.
+    using namespace mesh_cache_detail;
+    auto file = mapped_file::open(path);
+    if (!file || file->size() < sizeof(header))
+        return false;
+
+    header h;
+    std::memcpy(&h, file->data(), sizeof(h));
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != mesh_cache_version
+        || h.byte_order != byte_order_mark || h.key != id.key || h.source_size != id.source_size
+        || h.source_time != id.source_time)
+        return false;
+    if (file->size() < sizeof(header) + uint64_t(h.section_count) * sizeof(section))
+        return false;
+
+    std::vector<section> sections(h.section_count);
+    std::memcpy(sections.data(), file->data() + sizeof(header), sections.size() * sizeof(section));
+
+    mesh_cache_contents read;
+    mesh pending_mesh;
+    bvh_info_record info = {};
+    const section* nodes = nullptr;
+    const section* order = nullptr;
+    for (const section& s : sections) {
+        if (s.offset % alignment != 0 || s.offset > file->size()
+            || s.count > (file->size() - s.offset) / std::max<uint32_t>(s.element_size, 1))
+            return false;
+        switch (s.kind) {
+            case positions_x:
+            case positions_y:
+            case positions_z:
+                if (s.element_size != sizeof(double)) return false;
+                (s.kind == positions_x ? pending_mesh.x : s.kind == positions_y ? pending_mesh.y : pending_mesh.z) = view<double>(file, s);
+                break;
+            case indices:
+                if (s.element_size != sizeof(int)) return false;
+                pending_mesh.indices = view<int>(file, s);
+                if (!valid_mesh(pending_mesh)) return false;
+                read.meshes.push_back(pending_mesh);
+                break;
+            case bvh_info:
+                if (s.element_size != sizeof(bvh_info_record) || s.count != 1) return false;
+                std::memcpy(&info, file->data() + s.offset, sizeof(info));
+                read.has_bvh = true;
+                break;
+            case bvh_nodes: nodes = &s; break;
+            case bvh_order: order = &s; break;
+            default: return false;
+        }
+    }
+
+    if (read.has_bvh) {
+        if (!nodes || !order)
+            return false;
+        bvh_layout& bvh = read.bvh;
+        bvh.width = info.width;
+        bvh.bbox = aabb(point3(info.bbox[0], info.bbox[1], info.bbox[2]), point3(info.bbox[3], info.bbox[4], info.bbox[5]));
+        bvh.quality.sah_cost = info.sah_cost;
+        bvh.quality.depth = info.quality_depth;
+        bvh.quality.node_count = info.node_count;
+        bvh.quality.leaf_count = info.leaf_count;
+        bvh.quality.duplication = info.duplication;
+        if (order->element_size != sizeof(int))
+            return false;
+        shared_array<int> leaf_order = view<int>(file, *order);
+        size_t primitives = 0;
+        for (const mesh& m : read.meshes)
+            primitives += m.triangle_count();
+        for (size_t k = 0; k < leaf_order.size(); ++k)
+            if (leaf_order[k] < 0 || static_cast<size_t>(leaf_order[k]) >= primitives)
+                return false;
+        if (info.width == 8 && nodes->element_size == sizeof(wide_bvh_node<8>))
+            bvh.wide8 = wide_bvh<8>(view<wide_bvh_node<8>>(file, *nodes), leaf_order, info.depth);
+        else if (info.width == 4 && nodes->element_size == sizeof(wide_bvh_node<4>))
+            bvh.wide4 = wide_bvh<4>(view<wide_bvh_node<4>>(file, *nodes), leaf_order, info.depth);
+        else if (info.width == 2 && nodes->element_size == sizeof(linear_bvh_node))
+            bvh.binary = linear_bvh(view<linear_bvh_node>(file, *nodes), leaf_order, info.depth);
+        else
+            return false;
+        bool valid = (info.width == 8) ? valid_tree(bvh.wide8) : (info.width == 4) ? valid_tree(bvh.wide4) : valid_tree(bvh.binary);
+        if (!valid)
+            return false;
+    }
+
+    contents = std::move(read);
+    return true;
+}
+
+inline bool write_mesh_cache(const std::string& path, const mesh_cache_id& id, const std::vector<mesh>& meshes,
+                             const bvh_layout* bvh) {
+    // Writes to a temporary file and renames it into place, so a reader never maps a partial
+    // cache. Every writer creates a temporary file of its own, so processes that load the same
+    // model cold at once each write a whole file, and whichever renames last wins. False if the
+    // file cannot be written, e.g. in a read-only resource directory.
+    using namespace mesh_cache_detail;
+    std::vector<pending_section> pending_sections;
+    for (const mesh& m : meshes) {
+        pending_sections.push_back(pending(positions_x, m.x));
+        pending_sections.push_back(pending(positions_y, m.y));
+        pending_sections.push_back(pending(positions_z, m.z));
+        pending_sections.push_back(pending(mesh_cache_detail::indices, m.indices));
+    }
+
+    bvh_info_record info = {};
+    if (bvh) {
+        info.width = bvh->width;
+        for (int a = 0; a < 3; ++a) {
+            info.bbox[a] = bvh->bbox.axis(a).min;
+            info.bbox[a + 3] = bvh->bbox.axis(a).max;
+        }
+        info.sah_cost = bvh->quality.sah_cost;
+        info.quality_depth = bvh->quality.depth;
+        info.node_count = bvh->quality.node_count;
+        info.leaf_count = bvh->quality.leaf_count;
+        info.duplication = bvh->quality.duplication;
+        pending_sections.push_back({ bvh_info, sizeof(info), &info, 1 });
+        if (bvh->width == 8) {
+            info.depth = bvh->wide8.depth;
+            pending_sections.push_back(pending(bvh_nodes, bvh->wide8.nodes));
+        } else if (bvh->width == 4) {
+            info.depth = bvh->wide4.depth;
+            pending_sections.push_back(pending(bvh_nodes, bvh->wide4.nodes));
+        } else {
+            info.depth = bvh->binary.depth;
+            pending_sections.push_back(pending(bvh_nodes, bvh->binary.nodes));
+        }
+        pending_sections.push_back(pending(bvh_order, bvh->order()));
+    }
+
+    header h = {};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = mesh_cache_version;
+    h.byte_order = byte_order_mark;
+    h.key = id.key;
+    h.source_size = id.source_size;
+    h.source_time = id.source_time;
+    h.section_count = static_cast<uint32_t>(pending_sections.size());
+
+    auto align = [](uint64_t offset) { return (offset + alignment - 1) / alignment * alignment; };
+    std::vector<section> sections;
+    uint64_t offset = align(sizeof(header) + pending_sections.size() * sizeof(section));
+    for (const pending_section& p : pending_sections) {
+        sections.push_back({ p.kind, p.element_size, offset, p.count });
+        offset = align(offset + p.count * p.element_size);
+    }
+
+    // The temporary name adds the process id and a random suffix, and the file is created
+    // exclusively ("x"), so no two writers ever share it.
+    std::string temporary;
+    std::FILE* out = nullptr;
+    std::random_device entropy;
+    for (int attempt = 0; attempt < 8 && !out; ++attempt) {
+        char suffix[64];
+        std::snprintf(suffix, sizeof(suffix), ".%lld.%08x%08x.tmp", process_id(), entropy(), entropy());
+        temporary = path + suffix;
+        out = std::fopen(temporary.c_str(), "wbx");
+    }
+    if (!out)
+        return false;
+
+    const char padding[alignment] = {};
+    uint64_t written = 0;
+    bool ok = true;
+    auto write = [&](const void* data, uint64_t size) {
+        if (size > 0)
+            ok = ok && std::fwrite(data, 1, static_cast<size_t>(size), out) == size;
+        written += size;
+    };
+    write(&h, sizeof(h));
+    write(sections.data(), sections.size() * sizeof(section));
+    for (size_t k = 0; k < sections.size(); ++k) {
+        write(padding, sections[k].offset - written);
+        write(pending_sections[k].data, pending_sections[k].count * pending_sections[k].element_size);
+    }
+    ok = (std::fclose(out) == 0) && ok;
+    if (!ok) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+#if defined(_WIN32)
+    std::remove(path.c_str()); // rename does not replace an existing file there
+#endif
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif // MESH_CACHE_H
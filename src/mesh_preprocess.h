@@ -0,0 +1,151 @@
+#ifndef MESH_PREPROCESS_H
+#define MESH_PREPROCESS_H
+
+#include "rtweekend.h"
+
+#include "lbvh_build.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct mesh_preprocess_stats {
+    // Sizes of meshes before and after preprocess_mesh, summed over every mesh added.
+    size_t vertices_before = 0, vertices_after = 0;
+    size_t triangles_before = 0, triangles_after = 0;
+    size_t degenerate_triangles = 0; // Dropped for repeated corners or zero area
+    size_t bytes_before = 0, bytes_after = 0; // Vertex and index buffers
+
+    void add(const mesh_preprocess_stats& other) {
+        vertices_before += other.vertices_before;
+        vertices_after += other.vertices_after;
+        triangles_before += other.triangles_before;
+        triangles_after += other.triangles_after;
+        degenerate_triangles += other.degenerate_triangles;
+        bytes_before += other.bytes_before;
+        bytes_after += other.bytes_after;
+    }
+};
+
+inline size_t mesh_buffer_bytes(const mesh& m) {
+    return 3 * m.vertex_count() * sizeof(double) + m.indices.size() * sizeof(int);
+}
+
+inline mesh preprocess_mesh(const mesh& source, mesh_preprocess_stats* stats = nullptr) {
+    // Prepares an imported mesh for rendering:
+    //  - vertices with identical positions are welded into one, so triangles that share a corner
+    //    share its index;
+    //  - triangles that are degenerate after welding (a repeated corner, or corners on one line so
+    //    that the normal is zero) are dropped, since no ray can hit them;
+    //  - the triangles are sorted along the Morton curve through their centroids, and the vertices
+    //    renumbered in the order the sorted triangles first use them, dropping unused ones.
+    // Nearby triangles then lie next to each other in memory, and so do their vertices: a BVH
+    // leaf, and the leaves of a subtree, read a few contiguous runs instead of scattered entries.
+    int vertex_count = static_cast<int>(source.vertex_count());
+    int triangle_count = static_cast<int>(source.triangle_count());
+
+    // Weld: an open-addressing hash table over the positions maps every vertex to the first
+    // vertex with the same position.
+    size_t table_size = 16;
+    while (table_size < 2 * static_cast<size_t>(vertex_count))
+        table_size *= 2;
+    std::vector<int> table(table_size, -1);
+    auto bits = [](double value) {
+        uint64_t b;
+        value += 0.0; // -0 becomes +0, which compares equal to it
+        std::memcpy(&b, &value, sizeof(b));
+        return b;
+    };
+    std::vector<int> welded(vertex_count);
+    for (int v = 0; v < vertex_count; ++v) {
+        uint64_t h = bits(source.x[v]) * 0x9e3779b97f4a7c15ull;
+        h = (h ^ (h >> 29) ^ bits(source.y[v])) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 32) ^ bits(source.z[v])) * 0x94d049bb133111ebull;
+        size_t slot = static_cast<size_t>(h ^ (h >> 31)) & (table_size - 1);
+        while (table[slot] >= 0) {
+            int other = table[slot];
+            if (source.x[other] == source.x[v] && source.y[other] == source.y[v] && source.z[other] == source.z[v])
+                break;
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] < 0)
+            table[slot] = v;
+        welded[v] = table[slot];
+    }
+    std::vector<int>().swap(table);
+
+    // Keep the triangles that can be hit, then key them by the Morton code of their centroid on a
+    // 2^21 grid over the centroids' bounds.
+    auto centroid_of = [&](int k) {
+        return (source.vertex(source.indices[3 * k]) + source.vertex(source.indices[3 * k + 1])
+                + source.vertex(source.indices[3 * k + 2])) / 3;
+    };
+    struct keyed_triangle {
+        uint64_t code;
+        int triangle;
+    };
+    std::vector<keyed_triangle> kept;
+    kept.reserve(triangle_count);
+    aabb centroid_box = aabb::empty;
+    for (int k = 0; k < triangle_count; ++k) {
+        int a = welded[source.indices[3 * k]], b = welded[source.indices[3 * k + 1]], c = welded[source.indices[3 * k + 2]];
+        if (a == b || b == c || a == c)
+            continue;
+        point3 v0 = source.vertex(a), v1 = source.vertex(b), v2 = source.vertex(c);
+        vec3 normal = cross(v1 - v0, v2 - v0);
+        if (normal.x() == 0 && normal.y() == 0 && normal.z() == 0)
+            continue;
+        point3 center = centroid_of(k);
+        centroid_box = aabb(centroid_box, aabb(center, center));
+        kept.push_back({ 0, k });
+    }
+
+    const double cells = static_cast<double>(1 << 21);
+    for (keyed_triangle& t : kept) {
+        point3 center = centroid_of(t.triangle);
+        uint64_t q[3];
+        for (int a = 0; a < 3; ++a) {
+            double extent = centroid_box.axis(a).size();
+            double u = (extent > 0) ? (center[a] - centroid_box.axis(a).min) / extent : 0.0;
+            q[a] = static_cast<uint64_t>(std::clamp(u * cells, 0.0, cells - 1));
+        }
+        t.code = morton_code(q[0], q[1], q[2]);
+    }
+    std::sort(kept.begin(), kept.end(), [](const keyed_triangle& a, const keyed_triangle& b) {
+        return a.code != b.code ? a.code < b.code : a.triangle < b.triangle;
+    });
+
+    // Renumber the vertices in order of first use.
+    std::vector<int> renumbered(vertex_count, -1);
+    std::vector<double> x, y, z;
+    std::vector<int> indices;
+    indices.reserve(3 * kept.size());
+    for (const keyed_triangle& t : kept) {
+        for (int corner = 0; corner < 3; ++corner) {
+            int v = welded[source.indices[3 * t.triangle + corner]];
+            if (renumbered[v] < 0) {
+                renumbered[v] = static_cast<int>(x.size());
+                x.push_back(source.x[v]);
+                y.push_back(source.y[v]);
+                z.push_back(source.z[v]);
+            }
+            indices.push_back(renumbered[v]);
+        }
+    }
+    mesh result(std::move(x), std::move(y), std::move(z), std::move(indices));
+
+    if (stats) {
+        stats->vertices_before += source.vertex_count();
+        stats->vertices_after += result.vertex_count();
+        stats->triangles_before += source.triangle_count();
+        stats->triangles_after += result.triangle_count();
+        stats->degenerate_triangles += source.triangle_count() - result.triangle_count();
+        stats->bytes_before += mesh_buffer_bytes(source);
+        stats->bytes_after += mesh_buffer_bytes(result);
+    }
+    return result;
+}
+
+#endif // MESH_PREPROCESS_H
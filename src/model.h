@@ -8,100 +8,163 @@
 #include "rtweekend.h"
 #include "triangle.h"
 #include "hittable_list.h"
+#include "instance.h"
 #include "material.h"
+#include "bvh.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_preprocess.h"
+#include "obj_reader.h"
+#include "triangle_mesh.h"
 
+#include <chrono>
 #include <string>
 
-struct mesh{
-    mesh(std::vector<vec3> &vert, std::vector<int> &ind) {
-        vertices =vert;
-        indices = ind;
-    }
-    
-    std::vector<vec3> vertices;
-    std::vector<int> indices;
-};
 //basic model loading without materials or textures;
 class model{
 public:
     model(const std::string &path, double scale_ = 1.0, std::shared_ptr<material> mat = std::make_shared<lambertian>(vec3(0)) )
         : scale(scale_), mtr(mat)
     {
-        Assimp::Importer import;
-        const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate);
-        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
-            {
-                std::cerr << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // A cache written by an earlier run with the same file, scale, reader, preprocessing and
+        // BVH options is mapped instead of importing the file and building the BVH again.
+        bool obj_reader = use_obj_reader && is_obj_file(path);
+        if(use_cache && mesh_cache_key(path, scale, obj_reader, preprocess, bvh_options, cache_id)){
+            cache_path = mesh_cache_path(path, cache_id.key);
+            mesh_cache_contents cached;
+            if(read_mesh_cache(cache_path, cache_id, cached)){
+                geometry = merge_meshes(cached.meshes);
+                has_cached_bvh = cached.has_bvh;
+                cached_bvh = std::move(cached.bvh);
                 return;
             }
-        directory = path.substr(0, path.find_last_of('/'));
+        }
 
-        processNode(scene->mRootNode, scene);
+        // OBJ files go through the parallel reader; Assimp reads other formats, and OBJ files the
+        // reader turns down. Both flip z and scale the same way.
+        bool imported = obj_reader && read_obj(path, vec3(scale, scale, -scale), geometry);
+        if(!imported && !importWithAssimp(path))
+            return;
+        if(preprocess){
+            geometry = preprocess_mesh(geometry, &preprocess_stats);
+            preprocess_totals.add(preprocess_stats);
+        }
     }
     hittable_list getHittableList(){
+        // Every face as a standalone triangle, e.g. to mix them into another BVH. A compressed mesh
+        // gives its decoded positions.
+        mesh source = (object_mesh && geometry.triangle_count() == 0) ? object_mesh->triangles() : geometry;
         hittable_list triangles;
-        for(auto m: meshes){
-            for(int i = 0; i<m.indices.size(); i+=3){
-                triangles.add(std::make_shared<rotate_>(std::make_shared<triangle>
-                    (
-                    scale*m.vertices[m.indices[i+0]],
-                    scale*m.vertices[m.indices[i+1]],
-                    scale*m.vertices[m.indices[i+2]],
-                    mtr
-                    ),
-                    0, 0, 0
-                ));
-            }
+        for(int i = 0; i < (int)source.triangle_count(); i++){
+            point3 v0, v1, v2;
+            source.triangle_vertices(i, v0, v1, v2);
+            triangles.add(std::make_shared<triangle>(v0, v1, v2, mtr));
         }
         return triangles;
     }
-    hittable_list getHittableList(vec3 rotate, vec3 translation){
-        hittable_list triangles;
-        for(auto m: meshes){
-            for (int i = 0; i < m.indices.size(); i += 3) {
-                std::shared_ptr<hittable> currTriangle = std::make_shared<triangle>
-                    (
-                        scale * m.vertices[m.indices[i + 0]],
-                        scale * m.vertices[m.indices[i + 1]],
-                        scale * m.vertices[m.indices[i + 2]],
-                        mtr
-                    );
-
-                currTriangle = std::make_shared<rotate_>(currTriangle, rotate.x(), rotate.y(), rotate.z());
-                currTriangle = std::make_shared<translate>(currTriangle, translation);
-
-                triangles.add(currTriangle);
+    std::shared_ptr<triangle_mesh> getMesh(){
+        // The model's triangles as one mesh with its BVH in object space, built on first use and
+        // shared by every instance of the model. The BVH is built over the full positions, so the
+        // cache holds the same tree whatever the storage; a compressed mesh refits its own copy,
+        // and the model then drops its full positions.
+        if(!object_mesh){
+            bvh_layout tree;
+            if(has_cached_bvh){
+                tree = std::move(cached_bvh);
+            }else{
+                auto start = std::chrono::steady_clock::now();
+                tree = triangle_mesh::build_layout(geometry, triangle_mesh::leaf_build_options(bvh_options, mesh_leaf_format::batched));
+                bvh_build_seconds_total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if(!cache_path.empty() && geometry.triangle_count() > 0)
+                    write_mesh_cache(cache_path, cache_id, { geometry }, &tree);
             }
+            object_mesh = std::make_shared<triangle_mesh>(geometry, mtr, std::move(tree), mesh_leaf_format::batched, storage);
+            if(storage != mesh_storage::full)
+                geometry = mesh();
         }
-        return triangles;
+        return object_mesh;
+    }
+    std::shared_ptr<hittable> getInstance(vec3 rotate, vec3 translation){
+        // A placement of the shared mesh: rotated (in degrees about x, then y, then z), then moved.
+        affine_transform placement = affine_transform::translation(translation)
+                                   * affine_transform::rotation(rotate.x(), rotate.y(), rotate.z());
+        return std::make_shared<instance>(getMesh(), placement);
+    }
+    hittable_list getHittableList(vec3 rotate, vec3 translation){
+        return hittable_list(getInstance(rotate, translation));
     }
+
+    inline static bool use_cache = true; // Whether models read and write mesh caches
+    inline static bool use_obj_reader = true; // Whether OBJ files are read by read_obj rather than Assimp
+    inline static bool preprocess_meshes = true; // Whether imported meshes go through preprocess_mesh
+    inline static mesh_preprocess_stats preprocess_totals; // Summed over the models preprocessed so far
+    inline static double bvh_build_seconds_total = 0.0; // Time spent building model BVHs so far; cached BVHs add nothing
+
+    // Mesh sizes before and after preprocessing; all zero if the model was loaded from its cache
+    // or not preprocessed.
+    const mesh_preprocess_stats& preprocessStats() const { return preprocess_stats; }
+    inline static bvh_build_options default_bvh_options; // Options of the object-space BVH of models created afterwards
+    inline static mesh_storage default_mesh_storage = mesh_storage::full; // Storage of the meshes of models created afterwards
 private:
     std::string directory;
-    std::vector<mesh> meshes;
+    mesh geometry; // All meshes of the file merged, scaled to model space
     std::shared_ptr<material> mtr;
     double scale;
+    std::shared_ptr<triangle_mesh> object_mesh;
+    bool preprocess = preprocess_meshes;
+    mesh_preprocess_stats preprocess_stats;
+    bvh_build_options bvh_options = default_bvh_options;
+    mesh_storage storage = default_mesh_storage;
+    mesh_cache_id cache_id;
+    std::string cache_path; // Empty if the model is not cached
+    bool has_cached_bvh = false;
+    bvh_layout cached_bvh;
+
+    static bool is_obj_file(const std::string& path){
+        std::string extension = path.substr(path.find_last_of('.') + 1);
+        for(char& c : extension)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return extension == "obj";
+    }
     
-    void processNode(aiNode *node, const aiScene *scene){
+    bool importWithAssimp(const std::string &path){
+        Assimp::Importer import;
+        const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate);
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+            {
+                std::cerr << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+                return false;
+            }
+        std::vector<mesh> parts;
+        processNode(scene->mRootNode, scene, parts);
+        geometry = merge_meshes(parts);
+        return true;
+    }
+    void processNode(aiNode *node, const aiScene *scene, std::vector<mesh>& parts){
         for(int i=0;i<node->mNumMeshes;i++){
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            processMesh(mesh, scene);
+            processMesh(mesh, scene, parts);
         }
         for(int i=0;i<node->mNumChildren;i++){
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, parts);
         }
     }
-    void processMesh(aiMesh *aimesh, const aiScene *scene){
+    void processMesh(aiMesh *aimesh, const aiScene *scene, std::vector<mesh>& parts){
         
-        std::vector<vec3> vertices;
+        std::vector<double> x, y, z;
         std::vector<int> indices;
         
         for(int i=0;i<aimesh->mNumVertices;i++){
             
-            vec3 pos((double)aimesh->mVertices[i].x,
-                     (double)aimesh->mVertices[i].y,
-                     -(double)aimesh->mVertices[i].z);
+            vec3 pos = scale * vec3((double)aimesh->mVertices[i].x,
+                                    (double)aimesh->mVertices[i].y,
+                                    -(double)aimesh->mVertices[i].z);
             
-            vertices.push_back(pos);
+            x.push_back(pos.x());
+            y.push_back(pos.y());
+            z.push_back(pos.z());
         }
         for(int i = 0; i < aimesh->mNumFaces; i++)
         {
@@ -109,7 +172,7 @@ private:
             for(int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
-        meshes.push_back(mesh(vertices, indices));
+        parts.push_back(mesh(std::move(x), std::move(y), std::move(z), std::move(indices)));
     }
 };
 
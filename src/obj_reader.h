@@ -0,0 +1,261 @@
+#ifndef OBJ_READER_H
+#define OBJ_READER_H
+
+#include "rtweekend.h"
+
+#include "mapped_file.h"
+#include "mesh.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// A reader for the geometry of Wavefront OBJ files, for large scanned meshes where a general
+// importer spends far longer than reading the file takes. The file is mapped and cut into chunks
+// at line boundaries, the chunks are parsed in parallel straight into vertex and index arrays,
+// and those are joined into the contiguous buffers of one mesh. Only `v` and `f` lines are read:
+// texture coordinates, normals, groups and materials are skipped, and polygons are split into
+// fans from their first corner, as Assimp splits convex polygons.
+
+namespace obj_reader_detail {
+    const size_t chunk_bytes = 1 << 20; // Chunks are about this large, and at least one per thread
+
+    struct chunk_result {
+        std::vector<double> x, y, z;
+        std::vector<int> indices; // Absolute, or for negative references relative to the chunk's first vertex
+        std::vector<size_t> relative; // Entries of `indices` that are relative
+        bool failed = false;
+    };
+
+    inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    inline const char* skip_blanks(const char* p, const char* end) {
+        while (p < end && is_blank(*p))
+            ++p;
+        return p;
+    }
+
+    inline const char* parse_double(const char* p, const char* end, double& value) {
+        // Parses a decimal floating point number; returns the position after it, or null if there
+        // is none. Numbers of up to 19 significant digits with a small decimal exponent, which is
+        // what OBJ writers produce, are converted exactly by one multiplication or division of
+        // exactly representable values (Clinger's fast path); anything else goes to strtod.
+        static const double powers_of_ten[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        const char* start = p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+
+        uint64_t mantissa = 0;
+        int digits = 0, significant = 0, exponent = 0;
+        bool truncated = false;
+        auto add_digit = [&](int d, bool fraction) {
+            ++digits;
+            if (significant == 0 && d == 0) {
+                exponent -= fraction;
+                return;
+            }
+            if (significant < 19) {
+                mantissa = mantissa * 10 + d;
+                ++significant;
+                exponent -= fraction;
+            } else {
+                truncated = truncated || d != 0;
+                exponent += !fraction;
+            }
+        };
+        while (p < end && *p >= '0' && *p <= '9')
+            add_digit(*p++ - '0', false);
+        if (p < end && *p == '.') {
+            ++p;
+            while (p < end && *p >= '0' && *p <= '9')
+                add_digit(*p++ - '0', true);
+        }
+        if (digits == 0)
+            return nullptr;
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            const char* q = p + 1;
+            bool negative_exponent = false;
+            if (q < end && (*q == '-' || *q == '+'))
+                negative_exponent = (*q++ == '-');
+            if (q < end && *q >= '0' && *q <= '9') {
+                int e = 0;
+                while (q < end && *q >= '0' && *q <= '9')
+                    e = std::min(e * 10 + (*q++ - '0'), 100000);
+                exponent += negative_exponent ? -e : e;
+                p = q;
+            }
+        }
+
+        if (!truncated && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+            double m = static_cast<double>(mantissa);
+            value = (exponent < 0) ? m / powers_of_ten[-exponent] : m * powers_of_ten[exponent];
+        } else {
+            std::string token(start, p);
+            value = std::strtod(token.c_str(), nullptr);
+            return p;
+        }
+        if (negative)
+            value = -value;
+        return p;
+    }
+
+    inline const char* parse_int(const char* p, const char* end, long long& value) {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+        if (p == end || *p < '0' || *p > '9')
+            return nullptr;
+        long long v = 0;
+        while (p < end && *p >= '0' && *p <= '9')
+            v = std::min(v * 10 + (*p++ - '0'), 1LL << 40);
+        value = negative ? -v : v;
+        return p;
+    }
+
+    inline void parse_chunk(const char* p, const char* end, chunk_result& out) {
+        std::vector<long long> corners;
+        while (p < end) {
+            const char* line_end = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            if (!line_end)
+                line_end = end;
+            const char* last = line_end;
+            while (last > p && is_blank(last[-1]))
+                --last;
+            if (last > p && last[-1] == '\\') {
+                out.failed = true; // A line continued on the next one, which this reader does not join
+                return;
+            }
+            const char* q = skip_blanks(p, line_end);
+            if (line_end - q >= 2 && q[0] == 'v' && is_blank(q[1])) {
+                double v[3];
+                q += 2;
+                for (double& coordinate : v) {
+                    q = parse_double(skip_blanks(q, line_end), line_end, coordinate);
+                    if (!q) {
+                        out.failed = true;
+                        return;
+                    }
+                }
+                out.x.push_back(v[0]);
+                out.y.push_back(v[1]);
+                out.z.push_back(v[2]);
+            } else if (line_end - q >= 2 && q[0] == 'f' && is_blank(q[1])) {
+                corners.clear();
+                q = skip_blanks(q + 2, line_end);
+                while (q < line_end) {
+                    long long index;
+                    q = parse_int(q, line_end, index);
+                    if (!q || index == 0) {
+                        out.failed = true;
+                        return;
+                    }
+                    corners.push_back(index);
+                    while (q < line_end && !is_blank(*q))
+                        ++q; // Texture coordinate and normal references
+                    q = skip_blanks(q, line_end);
+                }
+                if (corners.size() < 3) {
+                    out.failed = true;
+                    return;
+                }
+                auto add = [&](long long index) {
+                    if (index > 0) {
+                        out.indices.push_back(static_cast<int>(std::min<long long>(index - 1, INT32_MAX)));
+                    } else {
+                        // Counted back from the last vertex so far, which may lie in an earlier chunk.
+                        out.relative.push_back(out.indices.size());
+                        out.indices.push_back(static_cast<int>(std::max<long long>(static_cast<long long>(out.x.size()) + index, INT32_MIN)));
+                    }
+                };
+                for (size_t k = 1; k + 1 < corners.size(); ++k) {
+                    add(corners[0]);
+                    add(corners[k]);
+                    add(corners[k + 1]);
+                }
+            }
+            if (line_end == end)
+                break;
+            p = line_end + 1;
+        }
+    }
+}
+
+inline bool read_obj(const std::string& path, const vec3& axis_scale, mesh& result) {
+    // Reads the triangles of an OBJ file into `result`, with every position multiplied
+    // componentwise by axis_scale. False if the file cannot be mapped, has no faces, has a `v` or
+    // `f` line it cannot parse, a line continued with a trailing backslash, or a face referring to
+    // a missing vertex; callers then fall back to a general importer. Other lines are skipped.
+    using namespace obj_reader_detail;
+    auto file = mapped_file::open(path);
+    if (!file)
+        return false;
+    const char* data = file->data();
+    size_t size = file->size();
+
+    // Chunk boundaries are moved forward to the next line start, so no line is split.
+    int threads = hardware_threads();
+    int chunk_count = static_cast<int>(std::clamp<size_t>(size / chunk_bytes, threads, 64 * size_t(threads)));
+    std::vector<size_t> bounds(chunk_count + 1);
+    for (int c = 0; c <= chunk_count; ++c) {
+        size_t position = (c == chunk_count) ? size : size * c / chunk_count;
+        if (c > 0 && c < chunk_count) {
+            position = std::max(position, bounds[c - 1]);
+            const void* newline = std::memchr(data + position, '\n', size - position);
+            position = newline ? static_cast<size_t>(static_cast<const char*>(newline) - data) + 1 : size;
+        }
+        bounds[c] = position;
+    }
+
+    std::vector<chunk_result> chunks(chunk_count);
+    parallel_for(chunk_count, threads, [&](int c, int) {
+        parse_chunk(data + bounds[c], data + bounds[c + 1], chunks[c]);
+    });
+
+    std::vector<size_t> first_vertex(chunk_count + 1, 0), first_index(chunk_count + 1, 0);
+    for (int c = 0; c < chunk_count; ++c) {
+        if (chunks[c].failed)
+            return false;
+        first_vertex[c + 1] = first_vertex[c] + chunks[c].x.size();
+        first_index[c + 1] = first_index[c] + chunks[c].indices.size();
+    }
+    size_t vertex_count = first_vertex[chunk_count];
+    if (first_index[chunk_count] == 0 || vertex_count > static_cast<size_t>(INT32_MAX))
+        return false;
+
+    std::vector<double> x(vertex_count), y(vertex_count), z(vertex_count);
+    std::vector<int> indices(first_index[chunk_count]);
+    std::vector<char> valid(chunk_count, 1);
+    parallel_for(chunk_count, threads, [&](int c, int) {
+        chunk_result& chunk = chunks[c];
+        size_t v0 = first_vertex[c];
+        for (size_t i = 0; i < chunk.x.size(); ++i) {
+            x[v0 + i] = axis_scale.x() * chunk.x[i];
+            y[v0 + i] = axis_scale.y() * chunk.y[i];
+            z[v0 + i] = axis_scale.z() * chunk.z[i];
+        }
+        for (size_t k : chunk.relative)
+            chunk.indices[k] += static_cast<int>(v0);
+        int* out = indices.data() + first_index[c];
+        for (size_t k = 0; k < chunk.indices.size(); ++k) {
+            int index = chunk.indices[k];
+            valid[c] &= (index >= 0 && static_cast<size_t>(index) < vertex_count);
+            out[k] = index;
+        }
+        chunk = chunk_result(); // Release the chunk's arrays as soon as they are copied
+    });
+    if (std::find(valid.begin(), valid.end(), 0) != valid.end())
+        return false;
+
+    result = mesh(std::move(x), std::move(y), std::move(z), std::move(indices));
+    return true;
+}
+
+#endif // OBJ_READER_H
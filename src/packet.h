@@ -0,0 +1,196 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+#include <cstdint>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define RT_PACKET_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define RT_PACKET_SSE2
+#endif
+
+// Number of rays traced together in a packet: 4, 8 or 16.
+#ifndef RT_PACKET_SIZE
+    #define RT_PACKET_SIZE 16
+#endif
+
+const int packet_size = RT_PACKET_SIZE;
+static_assert(packet_size == 4 || packet_size == 8 || packet_size == 16, "RT_PACKET_SIZE must be 4, 8 or 16");
+
+// When a packet reaches a node with this many or fewer active rays, the remaining rays leave the
+// packet and continue as single rays.
+const int packet_fallback_lanes = packet_size / 4;
+
+inline int lane_count(uint32_t mask) {
+    int n = 0;
+    for (; mask; mask &= mask - 1)
+        ++n;
+    return n;
+}
+
+struct alignas(32) ray_packet {
+    // A bundle of rays in structure-of-arrays layout, so one SIMD instruction works on several
+    // rays at once. Lanes that don't hold a ray are simply never marked active.
+    double ox[packet_size], oy[packet_size], oz[packet_size];
+    double dx[packet_size], dy[packet_size], dz[packet_size];
+    double inv_dx[packet_size], inv_dy[packet_size], inv_dz[packet_size];
+    double time[packet_size];
+
+    // Bounds of the origins and inverse directions over the packet, for interval-arithmetic culling.
+    // Only valid when `coherent`, i.e. every ray's direction has the same nonzero sign per axis.
+    bool coherent;
+    double origin_min[3], origin_max[3];
+    double inv_min[3], inv_max[3];
+
+    void set(int lane, const ray& r) {
+        ox[lane] = r.origin().x(); oy[lane] = r.origin().y(); oz[lane] = r.origin().z();
+        dx[lane] = r.direction().x(); dy[lane] = r.direction().y(); dz[lane] = r.direction().z();
+        time[lane] = r.time();
+    }
+
+    ray lane_ray(int lane) const {
+        return ray(point3(ox[lane], oy[lane], oz[lane]), vec3(dx[lane], dy[lane], dz[lane]), time[lane]);
+    }
+
+    void finalize(uint32_t active) {
+        // Computes the inverse directions and the packet bounds from the active lanes.
+        for (int l = 0; l < packet_size; ++l) {
+            inv_dx[l] = 1 / dx[l];
+            inv_dy[l] = 1 / dy[l];
+            inv_dz[l] = 1 / dz[l];
+        }
+
+        coherent = active != 0;
+        for (int a = 0; a < 3; ++a) {
+            const double* o = (a == 0) ? ox : (a == 1) ? oy : oz;
+            const double* d = (a == 0) ? dx : (a == 1) ? dy : dz;
+            const double* inv = (a == 0) ? inv_dx : (a == 1) ? inv_dy : inv_dz;
+            origin_min[a] = inv_min[a] = +infinity;
+            origin_max[a] = inv_max[a] = -infinity;
+            int positive = 0, negative = 0;
+            for (int l = 0; l < packet_size; ++l) {
+                if (!(active & (1u << l))) continue;
+                origin_min[a] = fmin(origin_min[a], o[l]);
+                origin_max[a] = fmax(origin_max[a], o[l]);
+                inv_min[a] = fmin(inv_min[a], inv[l]);
+                inv_max[a] = fmax(inv_max[a], inv[l]);
+                positive += d[l] > 0;
+                negative += d[l] < 0;
+            }
+            int lanes = lane_count(active);
+            if (positive != lanes && negative != lanes)
+                coherent = false;
+        }
+    }
+
+    bool frustum_misses(const aabb& box, double t_min, double t_max) const {
+        // Conservative test of the whole packet against a box (interval arithmetic over the packet
+        // bounds). Returns true only if no ray of the packet can hit the box within [t_min, t_max].
+        if (!coherent) return false;
+
+        double entry = t_min, exit = t_max;
+        for (int a = 0; a < 3; ++a) {
+            const interval& slab = box.axis(a);
+            double near_plane = (inv_min[a] > 0) ? slab.min : slab.max;
+            double far_plane = (inv_min[a] > 0) ? slab.max : slab.min;
+            entry = fmax(entry, product_min(near_plane - origin_max[a], near_plane - origin_min[a], inv_min[a], inv_max[a]));
+            exit = fmin(exit, product_max(far_plane - origin_max[a], far_plane - origin_min[a], inv_min[a], inv_max[a]));
+        }
+        return exit <= entry;
+    }
+
+private:
+    static double product_min(double a, double b, double c, double d) {
+        return fmin(fmin(a * c, a * d), fmin(b * c, b * d));
+    }
+
+    static double product_max(double a, double b, double c, double d) {
+        return fmax(fmax(a * c, a * d), fmax(b * c, b * d));
+    }
+};
+
+inline bool packet_lane_hits_box(const ray_packet& p, int lane, const aabb& box, double t_min, double t_max) {
+    // Scalar slab test of a single lane, using the packet's precomputed inverse directions.
+    const double o[3] = { p.ox[lane], p.oy[lane], p.oz[lane] };
+    const double inv[3] = { p.inv_dx[lane], p.inv_dy[lane], p.inv_dz[lane] };
+    for (int a = 0; a < 3; ++a) {
+        double t0 = (box.axis(a).min - o[a]) * inv[a];
+        double t1 = (box.axis(a).max - o[a]) * inv[a];
+        if (inv[a] < 0)
+            std::swap(t0, t1);
+        if (t0 > t_min) t_min = t0;
+        if (t1 < t_max) t_max = t1;
+        if (t_max <= t_min)
+            return false;
+    }
+    return true;
+}
+
+inline uint32_t packet_box_mask(const ray_packet& p, const aabb& box, double t_min, const double* t_max, uint32_t active) {
+    // Slab test of every lane against one box. Returns the mask of active lanes whose ray enters
+    // the box within [t_min, t_max[lane]], matching aabb::hit lane by lane.
+    uint32_t mask = 0;
+
+#if defined(RT_PACKET_AVX)
+    const __m256d bmin[3] = { _mm256_set1_pd(box.x.min), _mm256_set1_pd(box.y.min), _mm256_set1_pd(box.z.min) };
+    const __m256d bmax[3] = { _mm256_set1_pd(box.x.max), _mm256_set1_pd(box.y.max), _mm256_set1_pd(box.z.max) };
+    const __m256d tmin = _mm256_set1_pd(t_min);
+    for (int l = 0; l < packet_size; l += 4) {
+        const double* o[3] = { p.ox + l, p.oy + l, p.oz + l };
+        const double* inv[3] = { p.inv_dx + l, p.inv_dy + l, p.inv_dz + l };
+        __m256d t_near = tmin;
+        __m256d t_far = _mm256_loadu_pd(t_max + l);
+        for (int a = 0; a < 3; ++a) {
+            __m256d origin = _mm256_load_pd(o[a]);
+            __m256d inv_dir = _mm256_load_pd(inv[a]);
+            __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(bmin[a], origin), inv_dir);
+            __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(bmax[a], origin), inv_dir);
+            t_near = _mm256_max_pd(t_near, _mm256_min_pd(t0, t1));
+            t_far = _mm256_min_pd(t_far, _mm256_max_pd(t0, t1));
+        }
+        mask |= static_cast<uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(t_near, t_far, _CMP_LT_OQ))) << l;
+    }
+#elif defined(RT_PACKET_SSE2)
+    const __m128d bmin[3] = { _mm_set1_pd(box.x.min), _mm_set1_pd(box.y.min), _mm_set1_pd(box.z.min) };
+    const __m128d bmax[3] = { _mm_set1_pd(box.x.max), _mm_set1_pd(box.y.max), _mm_set1_pd(box.z.max) };
+    const __m128d tmin = _mm_set1_pd(t_min);
+    for (int l = 0; l < packet_size; l += 2) {
+        const double* o[3] = { p.ox + l, p.oy + l, p.oz + l };
+        const double* inv[3] = { p.inv_dx + l, p.inv_dy + l, p.inv_dz + l };
+        __m128d t_near = tmin;
+        __m128d t_far = _mm_loadu_pd(t_max + l);
+        for (int a = 0; a < 3; ++a) {
+            __m128d origin = _mm_load_pd(o[a]);
+            __m128d inv_dir = _mm_load_pd(inv[a]);
+            __m128d t0 = _mm_mul_pd(_mm_sub_pd(bmin[a], origin), inv_dir);
+            __m128d t1 = _mm_mul_pd(_mm_sub_pd(bmax[a], origin), inv_dir);
+            t_near = _mm_max_pd(t_near, _mm_min_pd(t0, t1));
+            t_far = _mm_min_pd(t_far, _mm_max_pd(t0, t1));
+        }
+        mask |= static_cast<uint32_t>(_mm_movemask_pd(_mm_cmplt_pd(t_near, t_far))) << l;
+    }
+#else
+    for (int l = 0; l < packet_size; ++l) {
+        const double o[3] = { p.ox[l], p.oy[l], p.oz[l] };
+        const double inv[3] = { p.inv_dx[l], p.inv_dy[l], p.inv_dz[l] };
+        double t_near = t_min, t_far = t_max[l];
+        for (int a = 0; a < 3; ++a) {
+            double t0 = (box.axis(a).min - o[a]) * inv[a];
+            double t1 = (box.axis(a).max - o[a]) * inv[a];
+            t_near = fmax(t_near, fmin(t0, t1));
+            t_far = fmin(t_far, fmax(t0, t1));
+        }
+        if (t_near < t_far) mask |= 1u << l;
+    }
+#endif
+
+    return mask & active;
+}
+
+#endif // PACKET_H
\ No newline at end of file
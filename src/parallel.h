@@ -0,0 +1,92 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline int hardware_threads() {
+    // Returns the number of hardware threads, or 1 if it cannot be determined.
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+class work_queue {
+public:
+    void push(int item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(item);
+    }
+
+    bool pop(int& item) {
+        // The owning thread takes work from the front of its own queue.
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) return false;
+        item = items.front();
+        items.pop_front();
+        return true;
+    }
+
+    bool steal(int& item) {
+        // Other threads take work from the back, away from where the owner is working.
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) return false;
+        item = items.back();
+        items.pop_back();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<int> items;
+};
+
+template <typename Body>
+void parallel_for(int count, int num_threads, const Body& body) {
+    // Calls body(index, thread_index) for every index in [0, count) on a set of worker threads.
+    // Each worker starts with a contiguous block of indices and, once it runs dry, steals from
+    // the back of the other workers' queues, so uneven per-item costs are balanced dynamically.
+    if (num_threads <= 0) num_threads = hardware_threads();
+    if (num_threads > count) num_threads = count;
+    if (num_threads <= 1) {
+        for (int i = 0; i < count; ++i)
+            body(i, 0);
+        return;
+    }
+
+    std::vector<work_queue> queues(num_threads);
+    for (int t = 0; t < num_threads; ++t) {
+        int begin = static_cast<int>(static_cast<long long>(count) * t / num_threads);
+        int end = static_cast<int>(static_cast<long long>(count) * (t + 1) / num_threads);
+        for (int i = begin; i < end; ++i)
+            queues[t].push(i);
+    }
+
+    auto worker = [&](int thread_index) {
+        int item;
+        while (true) {
+            if (queues[thread_index].pop(item)) {
+                body(item, thread_index);
+                continue;
+            }
+
+            // No new work is ever added, so once every queue is empty the worker is done.
+            bool stolen = false;
+            for (int k = 1; k < num_threads && !stolen; ++k)
+                stolen = queues[(thread_index + k) % num_threads].steal(item);
+            if (!stolen)
+                return;
+            body(item, thread_index);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; ++t)
+        threads.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+#endif // PARALLEL_H
\ No newline at end of file
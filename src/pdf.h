@@ -18,6 +18,7 @@ public:
     sphere_pdf() {}
 
     double value(const vec3& direction) const override {
+        STAT_COUNT(pdf_evaluations);
         return 1 / (4 * pi);
     }
 
@@ -31,6 +32,7 @@ public:
     cosine_pdf(const vec3& w) { uvw.build_from_w(w); }
 
     double value(const vec3& direction) const override {
+        STAT_COUNT(pdf_evaluations);
         double cosine_theta = dot(unit_vector(direction), uvw.w());
         return fmax(0, cosine_theta / pi);
     }
@@ -49,10 +51,12 @@ public:
         : objects(_objects), origin(_origin) {}
 
     double value(const vec3& direction) const override {
+        STAT_COUNT(pdf_evaluations);
         return objects.pdf_value(origin, direction);
     }
 
     vec3 generate() const override {
+        STAT_COUNT(light_samples);
         return objects.random(origin);
     }
 
@@ -73,7 +77,7 @@ public:
     }
 
     vec3 generate() const override {
-        if (random_double() < 0.5)
+        if (sample_1d() < 0.5)
             return p[0]->generate();
         else
             return p[1]->generate();
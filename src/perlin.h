@@ -5,16 +5,22 @@
 
 class perlin {
 public:
-    perlin() {
+    perlin(uint64_t seed = 0) {
+        // The noise tables come from their own generator, so a texture looks the same no matter
+        // how many random numbers were drawn before it was constructed.
+        pcg32 rng(seed, 0);
 
         ranvec = new vec3[point_count];
         for (int i = 0; i < point_count; ++i) {
-            ranvec[i] = unit_vector(vec3::random(-1, 1));
+            double x = -1 + 2 * rng.next_double();
+            double y = -1 + 2 * rng.next_double();
+            double z = -1 + 2 * rng.next_double();
+            ranvec[i] = unit_vector(vec3(x, y, z));
         }
 
-        perm_x = perlin_generate_perm();
-        perm_y = perlin_generate_perm();
-        perm_z = perlin_generate_perm();
+        perm_x = perlin_generate_perm(rng);
+        perm_y = perlin_generate_perm(rng);
+        perm_z = perlin_generate_perm(rng);
     }
 
     ~perlin() {
@@ -68,20 +74,20 @@ private:
     int* perm_y;
     int* perm_z;
 
-    static int* perlin_generate_perm() {
+    static int* perlin_generate_perm(pcg32& rng) {
         auto p = new int[point_count];
 
         for (int i = 0; i < perlin::point_count; ++i)
             p[i] = i;
 
-        permute(p, point_count);
+        permute(p, point_count, rng);
 
         return p;
     }
 
-    static void permute(int* p, int n) {
+    static void permute(int* p, int n, pcg32& rng) {
         for (int i = n - 1; i > 0; --i) {
-            int target = random_int(0, i);
+            int target = static_cast<int>(rng.next_double() * (i + 1));
             std::swap(p[i], p[target]);
         }
     }
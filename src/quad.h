@@ -28,6 +28,7 @@ public:
     aabb bounding_box() const override { return bbox; }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        STAT_COUNT(quad_tests);
         auto denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
@@ -53,6 +54,7 @@ public:
         rec.p = intersection;
         rec.mat = mat;
         rec.set_face_normal(r, normal);
+        STAT_COUNT(primitive_hits);
 
         return true;
     }
@@ -69,6 +71,7 @@ public:
     }
 
     double pdf_value(const point3& origin, const vec3& v) const override {
+        STAT_COUNT(light_pdf_rays);
         hit_record rec;
         if (!this->hit(ray(origin, v), interval(0.001, infinity), rec))
             return 0;
@@ -80,7 +83,9 @@ public:
     }
 
     vec3 random(const vec3& origin) const override {
-        point3 p = Q + (random_double() * u) + (random_double() * v);
+        double s, t;
+        sample_2d(s, t);
+        point3 p = Q + (s * u) + (t * v);
         return p - origin;
     }
 
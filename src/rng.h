@@ -0,0 +1,100 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+class pcg32 {
+public:
+    // PCG-XSH-RR generator (O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically
+    // Good Algorithms for Random Number Generation"). Each instance owns its state, so threads
+    // never contend for it, and `sequence` selects one of 2^63 independent streams.
+    pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+    pcg32(uint64_t initstate, uint64_t sequence) { seed(initstate, sequence); }
+
+    void seed(uint64_t initstate, uint64_t sequence) {
+        state = 0;
+        inc = (sequence << 1) | 1;
+        next_uint();
+        state += initstate;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old_state = state;
+        state = old_state * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old_state >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    double next_double() {
+        // Returns a random real in [0, 1) with 32 bits of resolution.
+        return next_uint() * (1.0 / 4294967296.0);
+    }
+
+    bool operator==(const pcg32& other) const { return state == other.state && inc == other.inc; }
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+inline uint64_t mix_bits(uint64_t v) {
+    // SplitMix64 finalizer: scrambles every input bit into every output bit.
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= v >> 33;
+    return v;
+}
+
+inline uint64_t hash_ints(uint64_t a, uint64_t b, uint64_t c) {
+    return mix_bits(mix_bits(mix_bits(a) ^ b) ^ c);
+}
+
+// Sample dimensions are laid out per path: the camera ray uses the first camera_dimensions
+// (pixel position, lens position, time), and every bounce then gets its own block of
+// bounce_dimensions, consumed in call order (light or BSDF choice, direction, Russian roulette).
+const uint32_t camera_dimensions = 6;
+const uint32_t bounce_dimensions = 8;
+
+class sampler;
+
+// Per-thread generator state. The renderer reseeds it from (seed, pixel, sample, bounce) before
+// tracing, so the random numbers a path sees depend only on which path it is, never on which
+// thread renders it or in which order the tiles are visited.
+struct thread_random_state {
+    pcg32 rng;
+    uint64_t sample_key = 0;
+
+    // Current sample of the active low-discrepancy sampler, if any (see sampler.h).
+    const sampler* pixel_sampler = nullptr;
+    uint64_t seed = 0;
+    uint32_t pixel_x = 0, pixel_y = 0;
+    uint32_t sample_index = 0;
+    uint32_t dimension = 0;
+};
+
+inline thread_random_state& thread_random() {
+    thread_local thread_random_state state;
+    return state;
+}
+
+inline void start_random_sample(uint64_t seed, uint64_t pixel_index, uint64_t sample_index) {
+    // Selects the random streams for one camera sample of one pixel. Camera ray generation draws
+    // from stream 0; bounce n draws from stream n + 1.
+    auto& state = thread_random();
+    state.sample_key = hash_ints(seed, pixel_index, sample_index);
+    state.rng.seed(state.sample_key, 0);
+}
+
+inline void start_random_bounce(int bounce) {
+    // Switches to the stream of the given bounce of the current sample, so each bounce draws the
+    // same numbers no matter how many the previous bounces consumed.
+    auto& state = thread_random();
+    state.rng.seed(state.sample_key, static_cast<uint64_t>(bounce) + 1);
+    state.dimension = camera_dimensions + static_cast<uint32_t>(bounce) * bounce_dimensions;
+}
+
+#endif // RNG_H
\ No newline at end of file
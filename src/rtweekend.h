@@ -6,6 +6,9 @@
 #include <limits>
 #include <memory>
 
+#include "rng.h"
+#include "stats.h"
+
 // Constants
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
@@ -16,8 +19,8 @@ inline double degrees_to_radians(double degrees) {
 }
 
 inline double random_double() {
-    // Returns a random real in [0, 1)
-    return rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0, 1) from the calling thread's generator.
+    return thread_random().rng.next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -29,6 +32,8 @@ inline int random_int(int min, int max) {
     return static_cast<int>(random_double(min, max + 1));
 }
 
+#include "sampler.h"
+
 // Common Headers
 
 #include "interval.h"
@@ -46,6 +51,8 @@ inline int random_int(int min, int max) {
 #include "quad.h"
 #include "constant_medium.h"
 #include "triangle.h"
+#include "triangle_mesh.h"
+#include "instance.h"
 #include "model.h"
 
 #endif // RTWEEKEND_H
\ No newline at end of file
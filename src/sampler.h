@@ -0,0 +1,247 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rng.h"
+
+#include <cstdint>
+#include <memory>
+
+enum class sampler_type {
+    independent, // Uniform random numbers
+    sobol,       // Owen-scrambled Sobol points, decorrelated per pixel
+    zsobol       // Owen-scrambled Sobol points spread across pixels in Morton order (blue-noise error)
+};
+
+class sampler {
+public:
+    // Supplies the well-distributed part of each path's random numbers. Implementations map
+    // (pixel, sample index, dimension) to a value, so they hold no per-thread state; the current
+    // pixel, sample and dimension live in the thread's random state.
+    virtual ~sampler() = default;
+
+    virtual double get_1d(const thread_random_state& state, uint32_t dimension) const = 0;
+    virtual void get_2d(const thread_random_state& state, uint32_t dimension, double& u, double& v) const = 0;
+};
+
+inline void start_pixel_sample(const sampler* s, uint64_t seed, int i, int j, int image_width, int sample_index) {
+    // Starts sample `sample_index` of pixel i, j: selects its random streams and resets the
+    // sampler to the first camera dimension.
+    start_random_sample(seed, static_cast<uint64_t>(j) * image_width + i, sample_index);
+    auto& state = thread_random();
+    state.pixel_sampler = s;
+    state.seed = seed;
+    state.pixel_x = static_cast<uint32_t>(i);
+    state.pixel_y = static_cast<uint32_t>(j);
+    state.sample_index = static_cast<uint32_t>(sample_index);
+    state.dimension = 0;
+}
+
+inline void end_pixel_samples() {
+    // Detaches the calling thread from the sampler of its last sample, which may be destroyed
+    // before the thread draws again; later draws are plain random numbers.
+    thread_random().pixel_sampler = nullptr;
+}
+
+inline double sample_1d() {
+    // Returns the next dimension of the current sample in [0, 1), or a plain random number when no
+    // sampler is active.
+    auto& state = thread_random();
+    if (!state.pixel_sampler)
+        return state.rng.next_double();
+    return state.pixel_sampler->get_1d(state, state.dimension++);
+}
+
+inline void sample_2d(double& u, double& v) {
+    // Returns the next two dimensions of the current sample in [0, 1)^2.
+    auto& state = thread_random();
+    if (!state.pixel_sampler) {
+        u = state.rng.next_double();
+        v = state.rng.next_double();
+        return;
+    }
+    state.pixel_sampler->get_2d(state, state.dimension, u, v);
+    state.dimension += 2;
+}
+
+// Owen-scrambled Sobol building blocks (Burley, "Practical Hash-based Owen Scrambling", JCGT 2020).
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+inline uint32_t sobol_dimension_1(uint32_t index) {
+    // Second Sobol dimension; its generator matrix is Pascal's triangle mod 2. (The first
+    // dimension is just reverse_bits(index).)
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+        if (index & 1) result ^= v;
+    return result;
+}
+
+inline double unit_from_bits(uint32_t x) {
+    return x * (1.0 / 4294967296.0);
+}
+
+inline void scrambled_sobol_2d(uint32_t index, uint32_t seed, double& u, double& v) {
+    // The first two Sobol dimensions form a (0,2)-sequence: every power-of-two prefix is stratified
+    // in every elementary interval. Shuffling the index and Owen-scrambling each dimension with
+    // independent seeds keeps that property while decorrelating different seeds.
+    index = nested_uniform_scramble(index, seed);
+    u = unit_from_bits(nested_uniform_scramble(reverse_bits(index), static_cast<uint32_t>(mix_bits(seed ^ 0xa511e9b3u))));
+    v = unit_from_bits(nested_uniform_scramble(sobol_dimension_1(index), static_cast<uint32_t>(mix_bits(seed ^ 0x63d83595u))));
+}
+
+inline double scrambled_sobol_1d(uint32_t index, uint32_t seed) {
+    index = nested_uniform_scramble(index, seed);
+    return unit_from_bits(nested_uniform_scramble(reverse_bits(index), static_cast<uint32_t>(mix_bits(seed ^ 0xa511e9b3u))));
+}
+
+class independent_sampler : public sampler {
+public:
+    double get_1d(const thread_random_state& state, uint32_t dimension) const override {
+        return thread_random().rng.next_double();
+    }
+
+    void get_2d(const thread_random_state& state, uint32_t dimension, double& u, double& v) const override {
+        u = thread_random().rng.next_double();
+        v = thread_random().rng.next_double();
+    }
+};
+
+class sobol_sampler : public sampler {
+public:
+    // Each pixel and each dimension (or pair of dimensions) gets its own scrambled (0,2)-sequence,
+    // so any number of samples is well stratified in every 1D and 2D projection that is sampled
+    // together, such as the pixel footprint, the lens, or a BSDF direction.
+    double get_1d(const thread_random_state& state, uint32_t dimension) const override {
+        return scrambled_sobol_1d(state.sample_index, pixel_seed(state, dimension));
+    }
+
+    void get_2d(const thread_random_state& state, uint32_t dimension, double& u, double& v) const override {
+        scrambled_sobol_2d(state.sample_index, pixel_seed(state, dimension), u, v);
+    }
+
+private:
+    static uint32_t pixel_seed(const thread_random_state& state, uint32_t dimension) {
+        uint64_t pixel = (static_cast<uint64_t>(state.pixel_y) << 32) | state.pixel_x;
+        return static_cast<uint32_t>(hash_ints(state.seed, pixel, dimension));
+    }
+};
+
+class zsobol_sampler : public sampler {
+public:
+    // Blue-noise variant (Ahmed and Wonka, "Screen-Space Blue-Noise Diffusion of Monte Carlo
+    // Sampling Error via Hierarchical Ordering of Pixels", 2020): instead of one sequence per
+    // pixel, neighbouring pixels take consecutive, randomly permuted blocks of one shared sequence
+    // along a Morton curve, so their errors are negatively correlated and look like blue noise.
+    zsobol_sampler(int samples_per_pixel, int image_width, int image_height) {
+        log2_spp = 0;
+        while ((1 << log2_spp) < samples_per_pixel)
+            ++log2_spp;
+        int resolution = 1, log2_resolution = 0;
+        while (resolution < image_width || resolution < image_height) {
+            resolution *= 2;
+            ++log2_resolution;
+        }
+        base4_digits = log2_resolution + (log2_spp + 1) / 2;
+        // Sobol indices have 32 bits. Beyond that, say 2048x2048 pixels at 2048 samples, pixels
+        // would wrap onto each other's indices and repeat their points, so every sample goes to
+        // the per-pixel sequences instead.
+        fits_index = 2 * log2_resolution + log2_spp <= 32;
+    }
+
+    double get_1d(const thread_random_state& state, uint32_t dimension) const override {
+        if (!fits_index || state.sample_index >= (1u << log2_spp))
+            return fallback.get_1d(state, dimension);
+        return scrambled_sobol_1d(sample_index(state, dimension), dimension_seed(state, dimension));
+    }
+
+    void get_2d(const thread_random_state& state, uint32_t dimension, double& u, double& v) const override {
+        // Samples beyond the pixel's block (adaptive or resumed renders) continue per pixel.
+        if (!fits_index || state.sample_index >= (1u << log2_spp)) {
+            fallback.get_2d(state, dimension, u, v);
+            return;
+        }
+        scrambled_sobol_2d(sample_index(state, dimension), dimension_seed(state, dimension), u, v);
+    }
+
+private:
+    int log2_spp;
+    int base4_digits;
+    bool fits_index; // Whether the Morton index of every sample fits in 32 bits
+    sobol_sampler fallback;
+
+    static uint32_t dimension_seed(const thread_random_state& state, uint32_t dimension) {
+        return static_cast<uint32_t>(hash_ints(state.seed, 0x2f5ef3a1u, dimension));
+    }
+
+    static uint64_t morton_2d(uint32_t x, uint32_t y) {
+        auto spread = [](uint64_t v) {
+            v &= 0xffffffff;
+            v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+            v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+            v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+            v = (v | (v << 2)) & 0x3333333333333333ULL;
+            v = (v | (v << 1)) & 0x5555555555555555ULL;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    uint32_t sample_index(const thread_random_state& state, uint32_t dimension) const {
+        // Permutes each base-4 digit of the pixel's Morton index by one of the 24 permutations of
+        // {0,1,2,3}, chosen by hashing the higher digits, so the hierarchy has no visible structure.
+        static const uint8_t permutations[24][4] = {
+            {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+            {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+            {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+            {3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}
+        };
+
+        uint64_t morton_index = (morton_2d(state.pixel_x, state.pixel_y) << log2_spp) | state.sample_index;
+        bool odd_log2_spp = (log2_spp & 1) != 0;
+        int last_digit = odd_log2_spp ? 1 : 0;
+
+        uint64_t index = 0;
+        for (int d = base4_digits - 1; d >= last_digit; --d) {
+            int digit_shift = 2 * d - (odd_log2_spp ? 1 : 0);
+            int digit = static_cast<int>((morton_index >> digit_shift) & 3);
+            uint64_t higher_digits = morton_index >> (digit_shift + 2);
+            int p = static_cast<int>((mix_bits(higher_digits ^ (0x55555555u * static_cast<uint64_t>(dimension))) >> 24) % 24);
+            index |= static_cast<uint64_t>(permutations[p][digit]) << digit_shift;
+        }
+        if (odd_log2_spp) {
+            uint64_t bit = morton_index & 1;
+            index |= bit ^ (mix_bits((morton_index >> 1) ^ (0x55555555u * static_cast<uint64_t>(dimension))) & 1);
+        }
+        return static_cast<uint32_t>(index);
+    }
+};
+
+inline std::shared_ptr<sampler> make_sampler(sampler_type type, int samples_per_pixel, int image_width, int image_height) {
+    switch (type) {
+    case sampler_type::independent: return std::make_shared<independent_sampler>();
+    case sampler_type::zsobol: return std::make_shared<zsobol_sampler>(samples_per_pixel, image_width, image_height);
+    default: return std::make_shared<sobol_sampler>();
+    }
+}
+
+#endif // SAMPLER_H
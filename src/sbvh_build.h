@@ -0,0 +1,298 @@
+#ifndef SBVH_BUILD_H
+#define SBVH_BUILD_H
+
+#include "rtweekend.h"
+
+#include "bvh_build.h"
+
+#include <functional>
+#include <vector>
+
+// Bounds of the part of primitive `primitive` that lies inside `box`.
+using bvh_clip_function = std::function<aabb(int primitive, const aabb& box)>;
+
+class sbvh_builder {
+public:
+    // Builds a BVH with spatial splits (Stich, Friedrich and Dietrich, "Spatial Splits in
+    // Bounding Volume Hierarchies", 2009). Every node weighs the best binned SAH object split
+    // against the best binned spatial split, which cuts the node's box with a plane and gives
+    // each side the clipped part of every primitive straddling it. A primitive can so end up in
+    // several leaves; these extra references are capped by options.sbvh_max_growth, and a
+    // straddling primitive is kept whole on one side when the SAH prefers that. Spatial splits
+    // are only tried where the object split's children overlap, since elsewhere they rarely win.
+    //
+    // Meant for final renders of scenes with long or overlapping primitives: the build clips
+    // primitives and runs on one thread, so it is much slower than the other builders.
+    sbvh_builder(const std::vector<aabb>& bounds, const bvh_build_options& options, bvh_clip_function clip)
+        : bounds(bounds), options(options), clip(std::move(clip)) {
+        this->options.sah_bins = std::max(this->options.sah_bins, 2);
+        this->options.max_leaf_size = std::clamp(this->options.max_leaf_size, 1, bvh_max_leaf_size);
+        if (!this->clip)
+            this->clip = [this](int p, const aabb& box) { return overlap(this->bounds[p], box); };
+    }
+
+    bvh_build_result build() {
+        bvh_build_result tree;
+        int n = static_cast<int>(bounds.size());
+        std::vector<reference> references(n);
+        aabb root_box = aabb::empty;
+        for (int i = 0; i < n; ++i) {
+            references[i] = { i, bounds[i] };
+            root_box = aabb(root_box, bounds[i]);
+        }
+        root_area = fmax(surface_area(root_box), 1e-300);
+        spare_references = static_cast<long long>(n * std::max(options.sbvh_max_growth, 0.0));
+
+        if (n > 0) {
+            tree.nodes.reserve(2 * static_cast<size_t>(n));
+            build_node(tree.nodes, references);
+        }
+        tree.order = std::move(order);
+        measure_bvh(tree, options);
+        if (n > 0)
+            tree.quality.duplication = static_cast<double>(tree.order.size()) / n;
+        return tree;
+    }
+
+private:
+    struct reference {
+        int primitive;
+        aabb box; // Bounds of the part of the primitive this reference covers
+    };
+
+    struct split_choice {
+        int axis = -1; // -1 if no split was found
+        int split = 0; // First bin of the right side
+        double cost = infinity; // Unnormalized SAH cost: area times count, summed over both sides
+        aabb left_box, right_box;
+    };
+
+    const std::vector<aabb>& bounds;
+    bvh_build_options options;
+    bvh_clip_function clip;
+    std::vector<int> order;
+    double root_area = 1.0;
+    long long spare_references = 0; // Remaining budget of extra references
+
+    int build_node(std::vector<bvh_build_node>& nodes, std::vector<reference>& references) {
+        // Builds the node over `references` and its subtree into `nodes`, depth first. The
+        // references are consumed.
+        int index = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+        int count = static_cast<int>(references.size());
+
+        aabb box = aabb::empty;
+        interval centroid_bounds[3];
+        for (const reference& r : references) {
+            box = aabb(box, r.box);
+            point3 c = centroid(r.box);
+            for (int a = 0; a < 3; ++a)
+                centroid_bounds[a] = interval(centroid_bounds[a], interval(c[a], c[a]));
+        }
+        nodes[index].bbox = box;
+        if (count == 1)
+            return make_leaf(nodes, index, references);
+
+        split_choice object = find_object_split(references, centroid_bounds);
+        split_choice spatial;
+        bool overlapping = object.axis < 0 || surface_area(overlap(object.left_box, object.right_box)) / root_area > options.sbvh_overlap;
+        if (spare_references > 0 && overlapping)
+            spatial = find_spatial_split(references, box);
+
+        double best_cost = fmin(object.cost, spatial.cost);
+        double split_cost = options.traversal_cost + best_cost / fmax(surface_area(box), 1e-300);
+        bool must_split = count > options.max_leaf_size;
+        if (!must_split && count <= split_cost)
+            return make_leaf(nodes, index, references);
+
+        std::vector<reference> left, right;
+        int axis = -1;
+        if (spatial.axis >= 0 && spatial.cost < object.cost) {
+            split_spatial(references, box, spatial, left, right);
+            if (!left.empty() && !right.empty())
+                axis = spatial.axis;
+            else
+                left.clear(), right.clear();
+        }
+        if (axis < 0 && object.axis >= 0) {
+            split_object(references, centroid_bounds, object, left, right);
+            axis = object.axis;
+        }
+        if (axis < 0) {
+            // All centroids coincide and space could not be split either: halve the references.
+            if (!must_split)
+                return make_leaf(nodes, index, references);
+            axis = box.longest_axis();
+            left.assign(references.begin(), references.begin() + count / 2);
+            right.assign(references.begin() + count / 2, references.end());
+        }
+        std::vector<reference>().swap(references);
+
+        nodes[index].axis = axis;
+        int left_index = build_node(nodes, left);
+        int right_index = build_node(nodes, right);
+        nodes[index].left = left_index;
+        nodes[index].right = right_index;
+        return index;
+    }
+
+    int make_leaf(std::vector<bvh_build_node>& nodes, int index, const std::vector<reference>& references) {
+        nodes[index].first = static_cast<int>(order.size());
+        nodes[index].count = static_cast<int>(references.size());
+        for (const reference& r : references)
+            order.push_back(r.primitive);
+        return index;
+    }
+
+    split_choice best_split(const std::vector<sah_bin>& bin_data) {
+        // The cheapest boundary over the bins of all three axes, with the boxes of its sides.
+        int bins = options.sah_bins;
+        split_choice choice;
+        std::vector<double> right_area(bins);
+        std::vector<int> right_count(bins);
+        for (int a = 0; a < 3; ++a)
+            if (sah_sweep(bin_data.data() + a * bins, bins, right_area, right_count, choice.cost, choice.split))
+                choice.axis = a;
+        if (choice.axis >= 0) {
+            const sah_bin* axis_bins = bin_data.data() + choice.axis * bins;
+            for (int i = 0; i < bins; ++i) {
+                aabb& side = (i < choice.split) ? choice.left_box : choice.right_box;
+                side = aabb(side, axis_bins[i].bbox);
+            }
+        }
+        return choice;
+    }
+
+    split_choice find_object_split(const std::vector<reference>& references, const interval* centroid_bounds) {
+        // Binned SAH over the reference centroids, as bvh_builder does.
+        int bins = options.sah_bins;
+        std::vector<sah_bin> bin_data(3 * static_cast<size_t>(bins));
+        for (int a = 0; a < 3; ++a) {
+            if (!(centroid_bounds[a].size() > 0))
+                continue;
+            double scale = bins / centroid_bounds[a].size();
+            for (const reference& r : references) {
+                sah_bin& target = bin_data[a * bins + sah_bin_index(centroid(r.box)[a], centroid_bounds[a].min, scale, bins)];
+                target.bbox = aabb(target.bbox, r.box);
+                ++target.entries;
+                ++target.exits;
+            }
+        }
+        return best_split(bin_data);
+    }
+
+    void split_object(std::vector<reference>& references, const interval* centroid_bounds, const split_choice& choice,
+                      std::vector<reference>& left, std::vector<reference>& right) {
+        int a = choice.axis;
+        double scale = options.sah_bins / centroid_bounds[a].size();
+        for (const reference& r : references) {
+            bool goes_left = sah_bin_index(centroid(r.box)[a], centroid_bounds[a].min, scale, options.sah_bins) < choice.split;
+            (goes_left ? left : right).push_back(r);
+        }
+    }
+
+    double plane_position(const aabb& box, int axis, int boundary) const {
+        // Position of the boundary before bin `boundary` when the box is cut into equal bins.
+        const interval& extent = box.axis(axis);
+        return (boundary >= options.sah_bins) ? extent.max : extent.min + extent.size() * boundary / options.sah_bins;
+    }
+
+    aabb clipped(const reference& r, int axis, double from, double to) const {
+        // The part of a reference between two planes across `axis`.
+        aabb slab = r.box;
+        interval& extent = (axis == 0) ? slab.x : (axis == 1) ? slab.y : slab.z;
+        extent = interval(fmax(extent.min, from), fmin(extent.max, to));
+        if (extent.size() < 0)
+            return aabb::empty;
+        return overlap(clip(r.primitive, slab), slab);
+    }
+
+    split_choice find_spatial_split(const std::vector<reference>& references, const aabb& box) {
+        // Bins every reference into all the bins its box spans along each axis, adding to each
+        // bin the bounds of the part clipped to it; a reference enters its first bin and exits
+        // its last.
+        int bins = options.sah_bins;
+        std::vector<sah_bin> bin_data(3 * static_cast<size_t>(bins));
+        for (int a = 0; a < 3; ++a) {
+            const interval& extent = box.axis(a);
+            if (!(extent.size() > 0))
+                continue;
+            double scale = bins / extent.size();
+            sah_bin* axis_bins = bin_data.data() + a * bins;
+            for (const reference& r : references) {
+                int first = sah_bin_index(r.box.axis(a).min, extent.min, scale, bins);
+                int last = sah_bin_index(r.box.axis(a).max, extent.min, scale, bins);
+                for (int i = first; i <= last; ++i) {
+                    aabb part = (first == last) ? r.box : clipped(r, a, plane_position(box, a, i), plane_position(box, a, i + 1));
+                    axis_bins[i].bbox = aabb(axis_bins[i].bbox, part);
+                }
+                ++axis_bins[first].entries;
+                ++axis_bins[last].exits;
+            }
+        }
+        split_choice choice = best_split(bin_data);
+        if (choice.axis < 0)
+            return choice;
+
+        // Keep within the reference budget: every straddling reference may be duplicated.
+        int a = choice.axis;
+        double scale = bins / box.axis(a).size();
+        long long straddling = 0;
+        for (const reference& r : references)
+            if (sah_bin_index(r.box.axis(a).min, box.axis(a).min, scale, bins) < choice.split
+                && sah_bin_index(r.box.axis(a).max, box.axis(a).min, scale, bins) >= choice.split)
+                ++straddling;
+        if (straddling > spare_references)
+            return split_choice();
+        return choice;
+    }
+
+    void split_spatial(const std::vector<reference>& references, const aabb& box, const split_choice& choice,
+                       std::vector<reference>& left, std::vector<reference>& right) {
+        // Sends every reference to the side of the plane it lies on. A straddling reference is
+        // clipped into both sides, unless moving it whole to one side costs less by the SAH.
+        int a = choice.axis;
+        int bins = options.sah_bins;
+        double scale = bins / box.axis(a).size();
+        double plane = plane_position(box, a, choice.split);
+        std::vector<const reference*> straddling;
+        for (const reference& r : references) {
+            int first = sah_bin_index(r.box.axis(a).min, box.axis(a).min, scale, bins);
+            int last = sah_bin_index(r.box.axis(a).max, box.axis(a).min, scale, bins);
+            if (last < choice.split)
+                left.push_back(r);
+            else if (first >= choice.split)
+                right.push_back(r);
+            else
+                straddling.push_back(&r);
+        }
+
+        aabb left_box = choice.left_box, right_box = choice.right_box;
+        double left_n = static_cast<double>(left.size() + straddling.size());
+        double right_n = static_cast<double>(right.size() + straddling.size());
+        for (const reference* r : straddling) {
+            aabb left_with = aabb(left_box, r->box), right_with = aabb(right_box, r->box);
+            double split_cost = surface_area(left_box) * left_n + surface_area(right_box) * right_n;
+            double left_cost = surface_area(left_with) * left_n + surface_area(right_box) * (right_n - 1);
+            double right_cost = surface_area(left_box) * (left_n - 1) + surface_area(right_with) * right_n;
+            aabb left_part = clipped(*r, a, -infinity, plane);
+            aabb right_part = clipped(*r, a, plane, infinity);
+            bool left_empty = left_part.x.size() < 0, right_empty = right_part.x.size() < 0;
+            if (right_empty || (!left_empty && left_cost < split_cost && left_cost <= right_cost)) {
+                left.push_back(*r);
+                left_box = left_with;
+                --right_n;
+            } else if (left_empty || right_cost < split_cost) {
+                right.push_back(*r);
+                right_box = right_with;
+                --left_n;
+            } else {
+                left.push_back({ r->primitive, left_part });
+                right.push_back({ r->primitive, right_part });
+            }
+        }
+        spare_references -= static_cast<long long>(left.size() + right.size() - references.size());
+    }
+};
+
+#endif // SBVH_BUILD_H
@@ -0,0 +1,235 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtweekend.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// A scene ready to render: the world (before its BVH is built), the objects to importance
+// sample, and a camera set up for it. Animated scenes also say how to move to a frame.
+struct scene {
+    hittable_list world;
+    hittable_list lights;
+    camera cam;
+    std::function<void(int frame)> animate; // Moves objects to the given frame; empty for still scenes
+};
+
+inline void cornell_box_walls(hittable_list& world) {
+    auto red = std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
+    auto white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    auto green = std::make_shared<lambertian>(color(0.12, 0.45, 0.15));
+
+    world.add(std::make_shared<quad>(point3(555,0,0), vec3(0,0,555), vec3(0,555,0), green));
+    world.add(std::make_shared<quad>(point3(0,0,555), vec3(0,0,-555), vec3(0,555,0), red));
+    world.add(std::make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,0,-555), white));
+    world.add(std::make_shared<quad>(point3(555,0,555), vec3(-555,0,0), vec3(0,555,0), white));
+}
+
+inline void cornell_box_camera(camera& cam) {
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 600;
+    cam.samples_per_pixel = 2000;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline scene cornellbox_bunny(const std::string& resource_dir) {
+    scene s;
+
+    auto gray = std::make_shared<lambertian>(color(0.5, 0.5,0.5));
+    auto light = std::make_shared<diffuse_light>(color(15, 15, 15));
+
+    // model
+    model model(resource_dir + "/models/bunny/bunny.obj", 1000, gray);
+    s.world = model.getHittableList(vec3(0, 0, 0), vec3(400, -30, 180));
+
+    cornell_box_walls(s.world);
+
+    // light
+    s.world.add(std::make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light));
+
+    // tall box
+    std::shared_ptr<material> aluminum = std::make_shared<metal>(color(0.8, 0.85, 0.88), 0.0);
+    std::shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), aluminum);
+    box1 = std::make_shared<rotate_y>(box1, 15);
+    box1 = std::make_shared<translate>(box1, vec3(265,0,295));
+    s.world.add(box1);
+
+    // sphere
+    auto glass = std::make_shared<dielectric>(1.5);
+    s.world.add(std::make_shared<sphere>(point3(190, 90, 190), 90, glass));
+
+    // importance sample objects
+    auto m = std::shared_ptr<material>();
+    s.lights.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), m));
+    s.lights.add(std::make_shared<sphere>(point3(190, 90, 190), 90, m));
+
+    cornell_box_camera(s.cam);
+    return s;
+}
+
+inline scene multi_light(const std::string& resource_dir) {
+    scene s;
+
+    auto gray = std::make_shared<lambertian>(color(0.5, 0.5,0.5));
+    auto light_white = std::make_shared<diffuse_light>(color(15, 15, 15));
+
+    // models
+    // model model_backpack(resource_dir + "/models/backpack/backpack.obj", 65, orange);
+    model model_suzanee(resource_dir + "/models/suzanne/suzanne.obj", 120, gray);
+    // world = model_backpack.getHittableList(vec3(0, 0, 0), vec3(360, 200, 200));
+    s.world = model_suzanee.getHittableList(vec3(0, -30, 0), vec3(250, 130, 350));
+
+    cornell_box_walls(s.world);
+
+    // Light
+    s.world.add(std::make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light_white));
+    s.world.add(std::make_shared<quad>(point3(1, 213, 330), vec3(0, 0, -105), vec3(0, 130,0), light_white));
+
+    // Light Sources
+    auto m = std::shared_ptr<material>();
+    s.lights.add(std::make_shared<sphere>(vec3(100, 350, 510), 25, m));
+
+    cornell_box_camera(s.cam);
+    return s;
+}
+
+inline scene sphere_field(int count, uint64_t seed = 1) {
+    // Synthetic stress scene: `count` small spheres of mixed materials scattered over a ground
+    // plane under an area light, placed by a fixed random stream so every run builds the same scene.
+    // When animated, every sphere drifts across the plane at its own velocity, motion blurred
+    // over each frame.
+    scene s;
+    pcg32 rng(seed, 0);
+    pcg32 motion_rng(seed, 1);
+    auto uniform = [&rng](double min, double max) { return min + (max - min) * rng.next_double(); };
+    std::vector<std::shared_ptr<sphere>> spheres;
+    std::vector<point3> start;
+    std::vector<vec3> velocity; // Distance moved per frame
+
+    auto ground = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    s.world.add(std::make_shared<quad>(point3(-1000, 0, -1000), vec3(2000, 0, 0), vec3(0, 0, 2000), ground));
+
+    double extent = 2.0 * std::sqrt(static_cast<double>(count));
+    for (int k = 0; k < count; ++k) {
+        double radius = uniform(0.15, 0.35);
+        point3 center(uniform(-extent, extent), radius, uniform(-extent, extent));
+        double choose_mat = uniform(0, 1);
+        std::shared_ptr<material> mat;
+        if (choose_mat < 0.8)
+            mat = std::make_shared<lambertian>(color(uniform(0, 1), uniform(0, 1), uniform(0, 1)));
+        else if (choose_mat < 0.95)
+            mat = std::make_shared<metal>(color(uniform(0.5, 1), uniform(0.5, 1), uniform(0.5, 1)), uniform(0, 0.5));
+        else
+            mat = std::make_shared<dielectric>(1.5);
+        auto ball = std::make_shared<sphere>(center, radius, mat);
+        s.world.add(ball);
+        spheres.push_back(ball);
+        start.push_back(center);
+        double heading = 2 * pi * motion_rng.next_double(), speed = 0.5 * motion_rng.next_double();
+        velocity.push_back(vec3(speed * cos(heading), 0, speed * sin(heading)));
+    }
+    s.animate = [spheres, start, velocity](int frame) {
+        for (size_t k = 0; k < spheres.size(); ++k)
+            spheres[k]->move(start[k] + frame * velocity[k], start[k] + (frame + 1) * velocity[k]);
+    };
+
+    auto light = std::make_shared<diffuse_light>(color(4, 4, 4));
+    point3 corner(-extent / 2, 3 * extent, -extent / 2);
+    s.world.add(std::make_shared<quad>(corner, vec3(extent, 0, 0), vec3(0, 0, extent), light));
+    s.lights.add(std::make_shared<quad>(corner, vec3(extent, 0, 0), vec3(0, 0, extent), std::shared_ptr<material>()));
+
+    s.cam.aspect_ratio = 16.0 / 9.0;
+    s.cam.image_width = 400;
+    s.cam.samples_per_pixel = 100;
+    s.cam.max_depth = 20;
+    s.cam.background = color(0.70, 0.80, 1.00);
+    s.cam.vfov = 30;
+    s.cam.lookfrom = point3(0, extent / 2, -extent * 1.5);
+    s.cam.lookat = point3(0, 0, 0);
+    s.cam.vup = vec3(0, 1, 0);
+    s.cam.defocus_angle = 0;
+    return s;
+}
+
+inline scene bunny_instances(const std::string& resource_dir, int count, uint64_t seed = 1) {
+    // `count` copies of the bunny on a ground plane, each an instance of one shared mesh BVH with
+    // its own rotation and position, so the mesh is stored once however many copies there are.
+    scene s;
+    pcg32 rng(seed, 0);
+    auto uniform = [&rng](double min, double max) { return min + (max - min) * rng.next_double(); };
+
+    auto ground = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    s.world.add(std::make_shared<quad>(point3(-1000, 0, -1000), vec3(2000, 0, 0), vec3(0, 0, 2000), ground));
+
+    auto white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    model bunny(resource_dir + "/models/bunny/bunny.obj", 10, white);
+    int side = std::max(static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count)))), 1);
+    double spacing = 2.0;
+    for (int k = 0; k < count; ++k) {
+        double x = (k % side - side / 2.0) * spacing + uniform(-0.3, 0.3);
+        double z = (k / side - side / 2.0) * spacing + uniform(-0.3, 0.3);
+        s.world.add(bunny.getInstance(vec3(0, uniform(0, 360), 0), vec3(x, -0.33, z)));
+    }
+
+    double extent = side * spacing;
+    auto light = std::make_shared<diffuse_light>(color(4, 4, 4));
+    point3 corner(-extent / 4, 2 * extent, -extent / 4);
+    s.world.add(std::make_shared<quad>(corner, vec3(extent / 2, 0, 0), vec3(0, 0, extent / 2), light));
+    s.lights.add(std::make_shared<quad>(corner, vec3(extent / 2, 0, 0), vec3(0, 0, extent / 2), std::shared_ptr<material>()));
+
+    s.cam.aspect_ratio = 16.0 / 9.0;
+    s.cam.image_width = 400;
+    s.cam.samples_per_pixel = 100;
+    s.cam.max_depth = 20;
+    s.cam.background = color(0.70, 0.80, 1.00);
+    s.cam.vfov = 30;
+    s.cam.lookfrom = point3(0, extent / 3, -extent * 1.2);
+    s.cam.lookat = point3(0, 0, 0);
+    s.cam.vup = vec3(0, 1, 0);
+    s.cam.defocus_angle = 0;
+    return s;
+}
+
+inline scene triangle_terrain(int count) {
+    // Synthetic stress scene: a height field of about `count` small triangles in a Cornell box,
+    // the many-small-primitives case that mesh models produce.
+    scene s;
+    cornell_box_walls(s.world);
+
+    int n = std::max(static_cast<int>(std::sqrt(count / 2.0)), 1);
+    double cell = 455.0 / n;
+    auto height = [](double x, double z) {
+        return 60 + 25 * sin(x * 0.031) * cos(z * 0.027) + 10 * sin(x * 0.11 + z * 0.07);
+    };
+    auto gray = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    for (int a = 0; a < n; ++a) {
+        for (int b = 0; b < n; ++b) {
+            double x0 = 50 + a * cell, x1 = x0 + cell;
+            double z0 = 50 + b * cell, z1 = z0 + cell;
+            point3 p00(x0, height(x0, z0), z0), p10(x1, height(x1, z0), z0);
+            point3 p01(x0, height(x0, z1), z1), p11(x1, height(x1, z1), z1);
+            s.world.add(std::make_shared<triangle>(p00, p10, p11, gray));
+            s.world.add(std::make_shared<triangle>(p00, p11, p01, gray));
+        }
+    }
+
+    auto light = std::make_shared<diffuse_light>(color(15, 15, 15));
+    s.world.add(std::make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light));
+    s.lights.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), std::shared_ptr<material>()));
+
+    cornell_box_camera(s.cam);
+    return s;
+}
+
+#endif // SCENES_H
@@ -26,7 +26,18 @@ public:
         center_vec = _center2 - _center1;
     }
 
+    // Moves the sphere to travel from _center1 at time 0 to _center2 at time 1, e.g. over the next
+    // frame of an animation. A BVH holding the sphere must be refit before it is traced again.
+    void move(point3 _center1, point3 _center2) {
+        vec3 rvec = vec3(radius, radius, radius);
+        bbox = aabb(aabb(_center1 - rvec, _center1 + rvec), aabb(_center2 - rvec, _center2 + rvec));
+        center1 = _center1;
+        center_vec = _center2 - _center1;
+        is_moving = true;
+    }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        STAT_COUNT(sphere_tests);
         point3 center = is_moving ? sphere_center(r.time()) : center1;
         vec3 oc = r.origin() - center;
         double a = r.direction().length_squared();
@@ -50,6 +61,7 @@ public:
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
         rec.mat = mat;
+        STAT_COUNT(primitive_hits);
         
         return true;
     }
@@ -59,6 +71,7 @@ public:
     double pdf_value(const point3& o, const vec3& v) const override {
         // This method only works for stationary spheres.
 
+        STAT_COUNT(light_pdf_rays);
         hit_record rec;
         if (!this->hit(ray(o, v), interval(0.001, infinity), rec))
             return 0;
@@ -107,8 +120,8 @@ private:
     }
 
     static vec3 random_to_sphere(double radius, double distance_squared) {
-        auto r1 = random_double();
-        auto r2 = random_double();
+        double r1, r2;
+        sample_2d(r1, r2);
         auto z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
 
         auto phi = 2 * pi * r1;
@@ -0,0 +1,209 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Render statistics: counters and histograms of hot-path events (BVH traversal steps, primitive
+// tests, path lengths, light samples, PDF evaluations). They exist only when RT_STATS is defined
+// (CMake option RAYTRACING_STATS); otherwise the STAT_* macros expand to nothing and cost nothing.
+//
+// Each thread counts into its own thread_local block, so the hot path never touches shared memory.
+// A block is merged into the process totals when its thread exits; render threads are joined
+// before camera::render reports, so the report sees every thread's counts.
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#define RT_STAT_COUNTERS(X)                                                                         \
+    X(camera_rays, "Camera rays")                                                                   \
+    X(extension_rays, "Extension rays (path segments)")                                             \
+    X(bvh_node_visits, "BVH node visits")                                                           \
+    X(packet_node_visits, "BVH node visits by ray packets")                                         \
+    X(aabb_tests, "Ray-box tests")                                                                  \
+    X(sphere_tests, "Ray-sphere tests")                                                             \
+    X(quad_tests, "Ray-quad tests")                                                                 \
+    X(triangle_tests, "Ray-triangle tests")                                                         \
+    X(primitive_hits, "Primitive hits")                                                             \
+    X(max_depth_paths, "Paths cut off at max_depth")                                                \
+    X(roulette_terminations, "Paths ended by Russian roulette")                                     \
+    X(skip_pdf_scatters, "Scatters with skip_pdf (specular)")                                       \
+    X(pdf_scatters, "Scatters sampled through the mixture pdf")                                     \
+    X(light_samples, "Light samples")                                                               \
+    X(light_pdf_rays, "Rays cast to evaluate light pdfs")                                           \
+    X(pdf_evaluations, "PDF evaluations")
+
+#define RT_STAT_HISTOGRAMS(X)                                                                       \
+    X(path_bounces, "Bounces per path (ray segments traced)")
+
+enum class stat_counter {
+#define RT_STAT_ENUM(name, label) name,
+    RT_STAT_COUNTERS(RT_STAT_ENUM)
+#undef RT_STAT_ENUM
+    count
+};
+
+enum class stat_histogram {
+#define RT_STAT_ENUM(name, label) name,
+    RT_STAT_HISTOGRAMS(RT_STAT_ENUM)
+#undef RT_STAT_ENUM
+    count
+};
+
+const int stat_counter_count = static_cast<int>(stat_counter::count);
+const int stat_histogram_count = static_cast<int>(stat_histogram::count);
+const int stat_histogram_bins = 64; // Values at or above the last bin are counted in it
+
+struct stats_block {
+    uint64_t counters[stat_counter_count] = {};
+    uint64_t histograms[stat_histogram_count][stat_histogram_bins] = {};
+
+    void merge(const stats_block& other) {
+        for (int c = 0; c < stat_counter_count; ++c)
+            counters[c] += other.counters[c];
+        for (int h = 0; h < stat_histogram_count; ++h)
+            for (int b = 0; b < stat_histogram_bins; ++b)
+                histograms[h][b] += other.histograms[h][b];
+    }
+
+    void clear() { *this = stats_block(); }
+
+    uint64_t counter(stat_counter c) const { return counters[static_cast<int>(c)]; }
+};
+
+inline std::mutex& stats_mutex() {
+    static std::mutex m;
+    return m;
+}
+
+inline stats_block& stats_totals() {
+    // Counts merged from threads that have exited.
+    static stats_block totals;
+    return totals;
+}
+
+struct thread_stats_block : stats_block {
+    ~thread_stats_block() {
+        std::lock_guard<std::mutex> lock(stats_mutex());
+        stats_totals().merge(*this);
+    }
+};
+
+inline stats_block& thread_stats() {
+    thread_local thread_stats_block block;
+    return block;
+}
+
+inline void stats_histogram_add(stat_histogram h, int value) {
+    int bin = (value < 0) ? 0 : (value >= stat_histogram_bins) ? stat_histogram_bins - 1 : value;
+    ++thread_stats().histograms[static_cast<int>(h)][bin];
+}
+
+#if defined(RT_STATS)
+    const bool stats_enabled = true;
+    #define STAT_COUNT(name) (++thread_stats().counters[static_cast<int>(stat_counter::name)])
+    #define STAT_ADD(name, n) (thread_stats().counters[static_cast<int>(stat_counter::name)] += (n))
+    #define STAT_HISTOGRAM(name, value) stats_histogram_add(stat_histogram::name, (value))
+#else
+    const bool stats_enabled = false;
+    #define STAT_COUNT(name) ((void)0)
+    #define STAT_ADD(name, n) ((void)0)
+    #define STAT_HISTOGRAM(name, value) ((void)0)
+#endif
+
+inline void stats_reset() {
+    // Clears the totals and the calling thread's counts. Call before starting render threads.
+    std::lock_guard<std::mutex> lock(stats_mutex());
+    stats_totals().clear();
+    thread_stats().clear();
+}
+
+inline stats_block stats_collect() {
+    // Returns the counts of every exited thread plus the calling thread.
+    std::lock_guard<std::mutex> lock(stats_mutex());
+    stats_block result = stats_totals();
+    result.merge(thread_stats());
+    return result;
+}
+
+inline void stats_report(const stats_block& s, std::ostream& out) {
+    // Prints every counter, its rate per camera ray, and the histograms with their means.
+    static const char* counter_labels[] = {
+#define RT_STAT_LABEL(name, label) label,
+        RT_STAT_COUNTERS(RT_STAT_LABEL)
+#undef RT_STAT_LABEL
+    };
+    static const char* histogram_labels[] = {
+#define RT_STAT_LABEL(name, label) label,
+        RT_STAT_HISTOGRAMS(RT_STAT_LABEL)
+#undef RT_STAT_LABEL
+    };
+
+    double camera_rays = static_cast<double>(s.counter(stat_counter::camera_rays));
+    std::streamsize precision = out.precision();
+    out << "Render statistics:\n";
+    for (int c = 0; c < stat_counter_count; ++c) {
+        out << "  " << std::left << std::setw(44) << counter_labels[c] << std::right << std::setw(16) << s.counters[c];
+        if (camera_rays > 0)
+            out << std::fixed << std::setprecision(3) << std::setw(12) << s.counters[c] / camera_rays << " per camera ray";
+        out << '\n';
+        out.unsetf(std::ios::floatfield);
+    }
+
+    for (int h = 0; h < stat_histogram_count; ++h) {
+        uint64_t total = 0, weighted = 0;
+        int last = 0;
+        for (int b = 0; b < stat_histogram_bins; ++b) {
+            total += s.histograms[h][b];
+            weighted += s.histograms[h][b] * b;
+            if (s.histograms[h][b] > 0) last = b;
+        }
+        out << "  " << histogram_labels[h] << " (mean "
+            << std::fixed << std::setprecision(3) << (total > 0 ? static_cast<double>(weighted) / total : 0.0) << "):\n";
+        out.unsetf(std::ios::floatfield);
+        for (int b = 0; b <= last && total > 0; ++b) {
+            double fraction = static_cast<double>(s.histograms[h][b]) / total;
+            out << "    " << std::setw(3) << b << (b == stat_histogram_bins - 1 ? "+" : " ")
+                << std::setw(14) << s.histograms[h][b] << "  " << std::string(static_cast<size_t>(fraction * 50 + 0.5), '#') << '\n';
+        }
+    }
+    out.precision(precision);
+}
+
+inline bool stats_write_json(const stats_block& s, const std::string& filename) {
+    // Writes the counters and histograms as a JSON object keyed by their names.
+    static const char* counter_names[] = {
+#define RT_STAT_NAME(name, label) #name,
+        RT_STAT_COUNTERS(RT_STAT_NAME)
+#undef RT_STAT_NAME
+    };
+    static const char* histogram_names[] = {
+#define RT_STAT_NAME(name, label) #name,
+        RT_STAT_HISTOGRAMS(RT_STAT_NAME)
+#undef RT_STAT_NAME
+    };
+
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "ERROR: Could not write statistics file '" << filename << "'.\n";
+        return false;
+    }
+    out << "{\n  \"counters\": {\n";
+    for (int c = 0; c < stat_counter_count; ++c)
+        out << "    \"" << counter_names[c] << "\": " << s.counters[c] << (c + 1 < stat_counter_count ? ",\n" : "\n");
+    out << "  },\n  \"histograms\": {\n";
+    for (int h = 0; h < stat_histogram_count; ++h) {
+        out << "    \"" << histogram_names[h] << "\": [";
+        int last = 0;
+        for (int b = 0; b < stat_histogram_bins; ++b)
+            if (s.histograms[h][b] > 0) last = b;
+        for (int b = 0; b <= last; ++b)
+            out << (b > 0 ? ", " : "") << s.histograms[h][b];
+        out << "]" << (h + 1 < stat_histogram_count ? ",\n" : "\n");
+    }
+    out << "  }\n}\n";
+    return static_cast<bool>(out);
+}
+
+#endif // STATS_H
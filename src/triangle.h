@@ -1,12 +1,119 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
+#include <algorithm>
 #include <vector>
 
 #include "rtweekend.h"
 #include "hittable.h"
 #include "material.h"
 
+inline void triangle_texture_uv(double& u, double& v) {
+    // Maps the barycentric coordinates of a hit to texture coordinates, the same for every triangle.
+    static const vec3 auv = vec3(0, 0, -1), buv = vec3(0, 1, -1), cuv = vec3(1, 0, -1);
+    vec3 d(u * auv + v * buv + (1 - u - v) * cuv);
+    u = d[0];
+    v = d[1];
+}
+
+inline aabb triangle_bounds(const point3& v0, const point3& v1, const point3& v2) {
+    interval ix(fmin(fmin(v0[0],v1[0]),v2[0]),fmax(fmax(v0[0],v1[0]),v2[0]));
+    interval iy(fmin(fmin(v0[1],v1[1]),v2[1]),fmax(fmax(v0[1],v1[1]),v2[1]));
+    interval iz(fmin(fmin(v0[2],v1[2]),v2[2]),fmax(fmax(v0[2],v1[2]),v2[2]));
+    return aabb(ix, iy, iz);
+}
+
+inline aabb clipped_triangle_bounds(const point3& v0, const point3& v1, const point3& v2, const aabb& box) {
+    // Clips the triangle against the six planes of the box (Sutherland-Hodgman) and bounds the
+    // polygon that remains. Each plane adds at most one vertex, so nine are enough.
+    point3 polygon[9] = { v0, v1, v2 };
+    point3 clipped[9];
+    int n = 3;
+    for (int a = 0; a < 3 && n > 0; ++a) {
+        for (int side = 0; side < 2 && n > 0; ++side) {
+            double plane = side ? box.axis(a).max : box.axis(a).min;
+            double sign = side ? -1.0 : 1.0; // Points with sign * (p[a] - plane) >= 0 are inside
+            int m = 0;
+            for (int i = 0; i < n; ++i) {
+                const point3& p = polygon[i];
+                const point3& q = polygon[(i + 1) % n];
+                double dp = sign * (p[a] - plane), dq = sign * (q[a] - plane);
+                if (dp >= 0)
+                    clipped[m++] = p;
+                if ((dp < 0) != (dq < 0)) {
+                    point3 crossing = p + (dp / (dp - dq)) * (q - p);
+                    crossing[a] = plane;
+                    clipped[m++] = crossing;
+                }
+            }
+            n = m;
+            std::copy(clipped, clipped + n, polygon);
+        }
+    }
+    if (n == 0)
+        return aabb::empty;
+
+    interval extent[3];
+    for (int i = 0; i < n; ++i)
+        for (int a = 0; a < 3; ++a)
+            extent[a] = interval(extent[a], interval(polygon[i][a], polygon[i][a]));
+    return overlap(aabb(extent[0], extent[1], extent[2]), box);
+}
+
+inline bool intersect_triangle(const ray& r, const point3& v0, const point3& v1, const point3& v2, const interval& ray_t,
+                               double& t, double& u, double& v) {
+    //Möller–Trumbore intersection algorithm
+    STAT_COUNT(triangle_tests);
+    const float EPSILON = 0.0000001;
+    vec3 e1, e2, pvec, tvec, qvec;
+    double det, inv_det;
+    e1 = v1 - v0;
+    e2 = v2 - v0;
+    pvec = cross(r.direction(), e2);
+    det = dot(e1, pvec);
+    inv_det = 1 / det;
+    if (fabs(det) < EPSILON) return false;
+    tvec = r.origin() - v0;
+    u = inv_det * dot(tvec, pvec);
+    if (u < 0.0 || u > 1) return false;
+    qvec = cross(tvec, e1);
+    v = inv_det * dot(r.direction(), qvec);
+    if (v < 0.0 || v + u > 1) return false;
+
+    t = inv_det * dot(e2, qvec);
+
+    return ray_t.contains(t);
+}
+
+inline void intersect_triangle_packet(const ray_packet& packet, const point3& v0, const point3& v1, const point3& v2,
+                                      double t_min, const double* t_max, double* t, double* u, double* v, bool* valid) {
+    // Möller–Trumbore for all lanes at once. The lane loop is branch free over
+    // structure-of-arrays data so the compiler can vectorize it; valid[l] tells which lanes hit
+    // within [t_min, t_max[l]].
+    const double EPSILON = static_cast<float>(0.0000001);
+    vec3 e1 = v1 - v0;
+    vec3 e2 = v2 - v0;
+
+    for (int l = 0; l < packet_size; ++l) {
+        double px = packet.dy[l] * e2.z() - packet.dz[l] * e2.y();
+        double py = packet.dz[l] * e2.x() - packet.dx[l] * e2.z();
+        double pz = packet.dx[l] * e2.y() - packet.dy[l] * e2.x();
+        double det = e1.x() * px + e1.y() * py + e1.z() * pz;
+        double inv_det = 1 / det;
+        double tx = packet.ox[l] - v0.x();
+        double ty = packet.oy[l] - v0.y();
+        double tz = packet.oz[l] - v0.z();
+        u[l] = inv_det * (tx * px + ty * py + tz * pz);
+        double qx = ty * e1.z() - tz * e1.y();
+        double qy = tz * e1.x() - tx * e1.z();
+        double qz = tx * e1.y() - ty * e1.x();
+        v[l] = inv_det * (packet.dx[l] * qx + packet.dy[l] * qy + packet.dz[l] * qz);
+        t[l] = inv_det * (e2.x() * qx + e2.y() * qy + e2.z() * qz);
+        valid[l] = (fabs(det) >= EPSILON) & (u[l] >= 0.0) & (u[l] <= 1) & (v[l] >= 0.0) & (v[l] + u[l] <= 1)
+                 & (t_min <= t[l]) & (t[l] <= t_max[l]);
+    }
+}
+
 class triangle : public hittable {
 public:
     triangle(point3 _v0, point3 _v1, point3 _v2, std::shared_ptr<material> m)
@@ -21,35 +128,18 @@ public:
     }
 
     void set_bounding_box() {
-        interval ix(fmin(fmin(v0[0],v1[0]),v2[0]),fmax(fmax(v0[0],v1[0]),v2[0]));
-        interval iy(fmin(fmin(v0[1],v1[1]),v2[1]),fmax(fmax(v0[1],v1[1]),v2[1]));
-        interval iz(fmin(fmin(v0[2],v1[2]),v2[2]),fmax(fmax(v0[2],v1[2]),v2[2]));
-        bbox = aabb(ix, iy, iz);
+        bbox = triangle_bounds(v0, v1, v2);
     }
 
     virtual aabb bounding_box() const override { return bbox; }
 
+    aabb clipped_bounding_box(const aabb& box) const override {
+        return clipped_triangle_bounds(v0, v1, v2, box);
+    }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        //Möller–Trumbore intersection algorithm
-        const float EPSILON = 0.0000001;
-        vec3 e1, e2, pvec, tvec, qvec;
-        double det, inv_det, u, v;
-        e1 = v1 - v0;
-        e2 = v2 - v0;
-        pvec = cross(r.direction(), e2);
-        det = dot(e1, pvec);
-        inv_det = 1 / det;
-        if (fabs(det) < EPSILON) return false;
-        tvec = r.origin() - v0;
-        u = inv_det * dot(tvec, pvec);
-        if (u < 0.0 || u > 1) return false;
-        qvec = cross(tvec, e1);
-        v = inv_det * dot(r.direction(), qvec);
-        if (v < 0.0 || v + u > 1) return false;
-
-        double t = inv_det * dot(e2, qvec);
-
-        if (!ray_t.contains(t))return false;
+        double t, u, v;
+        if (!intersect_triangle(r, v0, v1, v2, ray_t, t, u, v)) return false;
 
         rec.set_face_normal(r, normal);
         rec.t = t;
@@ -58,11 +148,36 @@ public:
         rec.u = u;
         rec.v = v;
         triangle_uv(rec.p, rec.u, rec.v);
+        STAT_COUNT(primitive_hits);
         return true;
 
     }
 
+    void hit_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const override {
+        double t[packet_size], u[packet_size], v[packet_size];
+        bool valid[packet_size];
+        intersect_triangle_packet(packet, v0, v1, v2, t_min, hits.t, t, u, v, valid);
+
+        for (int l = 0; l < packet_size; ++l) {
+            if (!(active & (1u << l))) continue;
+            STAT_COUNT(triangle_tests);
+            if (!valid[l]) continue;
+            ray r = packet.lane_ray(l);
+            hit_record rec;
+            rec.set_face_normal(r, normal);
+            rec.t = t[l];
+            rec.p = r.at(t[l]);
+            rec.mat = mat;
+            rec.u = u[l];
+            rec.v = v[l];
+            triangle_uv(rec.p, rec.u, rec.v);
+            STAT_COUNT(primitive_hits);
+            hits.record(l, rec);
+        }
+    }
+
     double pdf_value(const point3& origin, const vec3& v) const override {
+        STAT_COUNT(light_pdf_rays);
         hit_record rec;
         if (!this->hit(ray(origin, v), interval(0.001, infinity), rec))
             return 0;
@@ -74,8 +189,8 @@ public:
     }
 
     virtual vec3 random(const vec3& origin) const override {
-        double r1 = random_double();
-        double r2 = random_double();
+        double r1, r2;
+        sample_2d(r1, r2);
         point3 random_point = v0 + r1 * (v1 - v0) + r2 * (v2 - v1);
         return random_point - origin;
     }
@@ -86,12 +201,9 @@ private:
     double area;
     std::shared_ptr<material> mat;
     aabb bbox;
-    vec3 auv = vec3(0, 0, -1), buv = vec3(0, 1, -1), cuv = vec3(1, 0, -1);
 
     void triangle_uv(const vec3& p, double& u, double& v) const {
-        vec3 d(u * auv + v * buv + (1 - u - v) * cuv);
-        u = d[0];
-        v = d[1];
+        triangle_texture_uv(u, v);
     }
 };
 
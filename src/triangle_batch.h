@@ -0,0 +1,181 @@
+#ifndef TRIANGLE_BATCH_H
+#define TRIANGLE_BATCH_H
+
+#include "rtweekend.h"
+
+#include "packet.h"
+
+#include <cmath>
+#include <cstdint>
+
+const int triangle_batch_size = 4; // Triangles per batch, one per double lane of an AVX register (two SSE2 registers)
+
+struct alignas(32) triangle_batch {
+    // Four triangles with their vertices side by side (structure of arrays), so one SIMD kernel
+    // intersects them all. Unused slots hold a degenerate triangle at the origin, which nothing
+    // hits.
+    double a[3][triangle_batch_size]; // First vertex: x, y, z of each triangle
+    double b[3][triangle_batch_size];
+    double c[3][triangle_batch_size];
+};
+
+struct watertight_ray {
+    // A ray prepared for the watertight test of Woop, Benthin and Wald ("Watertight Ray/Triangle
+    // Intersection", 2013): axes permuted so the direction's largest component is z, and the
+    // shear that maps the direction to +z. Triangles are then tested in 2D against the origin,
+    // and edges shared by two triangles are classified the same way for both, so no ray slips
+    // between them.
+    double origin[3];
+    int kx, ky, kz;
+    double sx, sy, sz;
+
+    watertight_ray() {}
+
+    explicit watertight_ray(const ray& r) {
+        const vec3& d = r.direction();
+        kz = (fabs(d.x()) > fabs(d.y())) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        if (d[kz] < 0)
+            std::swap(kx, ky); // Keeps the winding, so the sign of the edge functions holds
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1.0 / d[kz];
+        for (int a = 0; a < 3; ++a)
+            origin[a] = r.origin()[a];
+    }
+};
+
+inline uint32_t intersect_triangle_batch(const triangle_batch& batch, uint32_t slots, const watertight_ray& r,
+                                         const interval& ray_t, double* t, double* u, double* v) {
+    // Watertight test of the ray against the triangles of the batch in the mask `slots`. Returns
+    // the mask of those hit within ray_t and, for them, stores the distance and the barycentric coordinates of the
+    // second and third vertex, as Möller–Trumbore reports them. Both faces are hit. The distance
+    // range is first checked against the unnormalized distance scaled by the determinant, so
+    // batches without a hit (the common case) pay no division.
+#if defined(RT_PACKET_AVX)
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d sx = _mm256_set1_pd(r.sx), sy = _mm256_set1_pd(r.sy), sz = _mm256_set1_pd(r.sz);
+    const __m256d ox = _mm256_set1_pd(r.origin[r.kx]), oy = _mm256_set1_pd(r.origin[r.ky]), oz = _mm256_set1_pd(r.origin[r.kz]);
+    auto shear = [&](const double (&p)[3][triangle_batch_size], __m256d& x, __m256d& y, __m256d& z) {
+        __m256d px = _mm256_sub_pd(_mm256_load_pd(p[r.kx]), ox);
+        __m256d py = _mm256_sub_pd(_mm256_load_pd(p[r.ky]), oy);
+        z = _mm256_sub_pd(_mm256_load_pd(p[r.kz]), oz);
+        x = _mm256_sub_pd(px, _mm256_mul_pd(sx, z));
+        y = _mm256_sub_pd(py, _mm256_mul_pd(sy, z));
+    };
+    __m256d ax, ay, az, bx, by, bz, cx, cy, cz;
+    shear(batch.a, ax, ay, az);
+    shear(batch.b, bx, by, bz);
+    shear(batch.c, cx, cy, cz);
+
+    __m256d U = _mm256_sub_pd(_mm256_mul_pd(cx, by), _mm256_mul_pd(cy, bx));
+    __m256d V = _mm256_sub_pd(_mm256_mul_pd(ax, cy), _mm256_mul_pd(ay, cx));
+    __m256d W = _mm256_sub_pd(_mm256_mul_pd(bx, ay), _mm256_mul_pd(by, ax));
+    __m256d negative = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(U, zero, _CMP_LT_OQ), _mm256_cmp_pd(V, zero, _CMP_LT_OQ)),
+                                    _mm256_cmp_pd(W, zero, _CMP_LT_OQ));
+    __m256d positive = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(U, zero, _CMP_GT_OQ), _mm256_cmp_pd(V, zero, _CMP_GT_OQ)),
+                                    _mm256_cmp_pd(W, zero, _CMP_GT_OQ));
+    __m256d det = _mm256_add_pd(_mm256_add_pd(U, V), W);
+    __m256d T = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(U, _mm256_mul_pd(sz, az)), _mm256_mul_pd(V, _mm256_mul_pd(sz, bz))),
+                              _mm256_mul_pd(W, _mm256_mul_pd(sz, cz)));
+    __m256d valid = _mm256_andnot_pd(_mm256_and_pd(negative, positive), _mm256_cmp_pd(det, zero, _CMP_NEQ_OQ));
+
+    // T / det within ray_t, compared as sign(det) * T against |det| * ray_t.
+    __m256d det_sign = _mm256_and_pd(det, _mm256_set1_pd(-0.0));
+    __m256d signed_T = _mm256_xor_pd(T, det_sign);
+    __m256d abs_det = _mm256_xor_pd(det, det_sign);
+    valid = _mm256_and_pd(valid, _mm256_cmp_pd(signed_T, _mm256_mul_pd(abs_det, _mm256_set1_pd(ray_t.min)), _CMP_GE_OQ));
+    valid = _mm256_and_pd(valid, _mm256_cmp_pd(signed_T, _mm256_mul_pd(abs_det, _mm256_set1_pd(ray_t.max)), _CMP_LE_OQ));
+    if ((static_cast<uint32_t>(_mm256_movemask_pd(valid)) & slots) == 0)
+        return 0;
+
+    // The exact test on the divided distance, so rounding of the scaled bounds never lets a hit
+    // past ray_t.
+    __m256d distance = _mm256_div_pd(T, det);
+    valid = _mm256_and_pd(valid, _mm256_cmp_pd(distance, _mm256_set1_pd(ray_t.min), _CMP_GE_OQ));
+    valid = _mm256_and_pd(valid, _mm256_cmp_pd(distance, _mm256_set1_pd(ray_t.max), _CMP_LE_OQ));
+    _mm256_storeu_pd(t, distance);
+    _mm256_storeu_pd(u, _mm256_div_pd(V, det));
+    _mm256_storeu_pd(v, _mm256_div_pd(W, det));
+    return static_cast<uint32_t>(_mm256_movemask_pd(valid)) & slots;
+#elif defined(RT_PACKET_SSE2)
+    // The same arithmetic on two halves of the batch, two triangles per SSE2 register.
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d sx = _mm_set1_pd(r.sx), sy = _mm_set1_pd(r.sy), sz = _mm_set1_pd(r.sz);
+    const __m128d ox = _mm_set1_pd(r.origin[r.kx]), oy = _mm_set1_pd(r.origin[r.ky]), oz = _mm_set1_pd(r.origin[r.kz]);
+    const __m128d t_min = _mm_set1_pd(ray_t.min), t_max = _mm_set1_pd(ray_t.max);
+    uint32_t mask = 0;
+    for (int h = 0; h < triangle_batch_size; h += 2) {
+        if (((slots >> h) & 3u) == 0)
+            continue;
+        auto shear = [&](const double (&p)[3][triangle_batch_size], __m128d& x, __m128d& y, __m128d& z) {
+            __m128d px = _mm_sub_pd(_mm_load_pd(p[r.kx] + h), ox);
+            __m128d py = _mm_sub_pd(_mm_load_pd(p[r.ky] + h), oy);
+            z = _mm_sub_pd(_mm_load_pd(p[r.kz] + h), oz);
+            x = _mm_sub_pd(px, _mm_mul_pd(sx, z));
+            y = _mm_sub_pd(py, _mm_mul_pd(sy, z));
+        };
+        __m128d ax, ay, az, bx, by, bz, cx, cy, cz;
+        shear(batch.a, ax, ay, az);
+        shear(batch.b, bx, by, bz);
+        shear(batch.c, cx, cy, cz);
+
+        __m128d U = _mm_sub_pd(_mm_mul_pd(cx, by), _mm_mul_pd(cy, bx));
+        __m128d V = _mm_sub_pd(_mm_mul_pd(ax, cy), _mm_mul_pd(ay, cx));
+        __m128d W = _mm_sub_pd(_mm_mul_pd(bx, ay), _mm_mul_pd(by, ax));
+        __m128d negative = _mm_or_pd(_mm_or_pd(_mm_cmplt_pd(U, zero), _mm_cmplt_pd(V, zero)), _mm_cmplt_pd(W, zero));
+        __m128d positive = _mm_or_pd(_mm_or_pd(_mm_cmpgt_pd(U, zero), _mm_cmpgt_pd(V, zero)), _mm_cmpgt_pd(W, zero));
+        __m128d det = _mm_add_pd(_mm_add_pd(U, V), W);
+        __m128d T = _mm_add_pd(_mm_add_pd(_mm_mul_pd(U, _mm_mul_pd(sz, az)), _mm_mul_pd(V, _mm_mul_pd(sz, bz))),
+                               _mm_mul_pd(W, _mm_mul_pd(sz, cz)));
+        __m128d valid = _mm_andnot_pd(_mm_and_pd(negative, positive), _mm_cmpneq_pd(det, zero));
+
+        __m128d det_sign = _mm_and_pd(det, _mm_set1_pd(-0.0));
+        __m128d signed_T = _mm_xor_pd(T, det_sign);
+        __m128d abs_det = _mm_xor_pd(det, det_sign);
+        valid = _mm_and_pd(valid, _mm_cmpge_pd(signed_T, _mm_mul_pd(abs_det, t_min)));
+        valid = _mm_and_pd(valid, _mm_cmple_pd(signed_T, _mm_mul_pd(abs_det, t_max)));
+        if (((static_cast<uint32_t>(_mm_movemask_pd(valid)) << h) & slots) == 0)
+            continue;
+
+        __m128d distance = _mm_div_pd(T, det);
+        valid = _mm_and_pd(valid, _mm_cmpge_pd(distance, t_min));
+        valid = _mm_and_pd(valid, _mm_cmple_pd(distance, t_max));
+        _mm_storeu_pd(t + h, distance);
+        _mm_storeu_pd(u + h, _mm_div_pd(V, det));
+        _mm_storeu_pd(v + h, _mm_div_pd(W, det));
+        mask |= static_cast<uint32_t>(_mm_movemask_pd(valid)) << h;
+    }
+    return mask & slots;
+#else
+    // The same arithmetic lane by lane.
+    uint32_t mask = 0;
+    for (int i = 0; i < triangle_batch_size; ++i) {
+        if (!(slots & (1u << i)))
+            continue;
+        double az = batch.a[r.kz][i] - r.origin[r.kz];
+        double bz = batch.b[r.kz][i] - r.origin[r.kz];
+        double cz = batch.c[r.kz][i] - r.origin[r.kz];
+        double ax = (batch.a[r.kx][i] - r.origin[r.kx]) - r.sx * az, ay = (batch.a[r.ky][i] - r.origin[r.ky]) - r.sy * az;
+        double bx = (batch.b[r.kx][i] - r.origin[r.kx]) - r.sx * bz, by = (batch.b[r.ky][i] - r.origin[r.ky]) - r.sy * bz;
+        double cx = (batch.c[r.kx][i] - r.origin[r.kx]) - r.sx * cz, cy = (batch.c[r.ky][i] - r.origin[r.ky]) - r.sy * cz;
+        double U = cx * by - cy * bx;
+        double V = ax * cy - ay * cx;
+        double W = bx * ay - by * ax;
+        bool outside = ((U < 0) | (V < 0) | (W < 0)) & ((U > 0) | (V > 0) | (W > 0));
+        double det = U + V + W;
+        double T = U * (r.sz * az) + V * (r.sz * bz) + W * (r.sz * cz);
+        if (outside || det == 0)
+            continue;
+        t[i] = T / det;
+        u[i] = V / det;
+        v[i] = W / det;
+        if (t[i] >= ray_t.min && t[i] <= ray_t.max)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+#endif // TRIANGLE_BATCH_H
@@ -0,0 +1,308 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "compressed_mesh.h"
+#include "hittable.h"
+#include "material.h"
+#include "mesh.h"
+#include "triangle.h"
+#include "triangle_batch.h"
+
+#include <vector>
+
+enum class mesh_leaf_format {
+    indexed, // Leaves read the shared vertex and index buffers
+    batched  // Leaves also get copies of their vertices in SIMD batches
+};
+
+class triangle_mesh : public hittable {
+public:
+    // The triangles of a mesh as one hittable: they share its vertex and index buffers and one
+    // material, under a BVH that refers to them by index. A triangle costs its three indices and
+    // its BVH reference, where a standalone `triangle` stores over 250 bytes plus the pointer
+    // and control block that hold it, and a leaf test reads the shared buffers directly.
+    // Bounds and texture coordinates match those of `triangle` exactly.
+    //
+    // In the batched format, the default, the triangles are also copied in BVH order into
+    // batches of four, so the triangle at order[k] is slot k % 4 of batch k / 4, and a leaf is
+    // tested with the watertight SIMD kernel of intersect_triangle_batch: no indirection through
+    // the index buffer, one vector test per four triangles, and no rays lost through shared
+    // edges. That costs 72 bytes per triangle.
+    // The indexed format tests each triangle with Möller–Trumbore, exactly as `triangle` does.
+    //
+    // With a compressed storage the mesh keeps only a compressed_mesh, and leaves decode their
+    // triangles as they test them: no batches are kept, and the batched format decodes a leaf
+    // four triangles at a time into a batch on the stack. The BVH is built (or given) for the
+    // full positions, then refitted to the decoded ones, so its bounds hold exactly the triangles
+    // that are tested.
+    triangle_mesh(mesh geometry, std::shared_ptr<material> mat, const bvh_build_options& options = bvh_build_options(),
+                  mesh_leaf_format format = mesh_leaf_format::batched, mesh_storage storage = mesh_storage::full)
+        : geometry(std::move(geometry)), mat(std::move(mat)), format(format), storage(storage)
+    {
+        tree = build_layout(this->geometry, leaf_build_options(options, format));
+        compress();
+        build_batches();
+    }
+
+    triangle_mesh(mesh geometry, std::shared_ptr<material> mat, bvh_layout built,
+                  mesh_leaf_format format = mesh_leaf_format::batched, mesh_storage storage = mesh_storage::full)
+        : geometry(std::move(geometry)), mat(std::move(mat)), tree(std::move(built)), format(format), storage(storage)
+    {
+        compress();
+        build_batches();
+    }
+
+    // The triangles as stored: decoded into a new mesh if the storage is compressed.
+    mesh triangles() const { return (storage == mesh_storage::full) ? geometry : packed.decode(); }
+    const bvh_layout& layout() const { return tree; }
+    const bvh_quality& quality() const { return tree.quality; }
+
+    static bvh_build_options leaf_build_options(bvh_build_options options, mesh_leaf_format format) {
+        // Batched leaves are built for whole batches: one batch test costs about what one
+        // triangle test does, so a node visit is charged as a batch's worth of triangles, and a
+        // leaf may fill two batches.
+        if (format == mesh_leaf_format::batched) {
+            options.traversal_cost *= triangle_batch_size;
+            options.max_leaf_size = std::max(options.max_leaf_size, 2 * triangle_batch_size);
+        }
+        return options;
+    }
+    mesh_leaf_format leaf_format() const { return format; }
+    mesh_storage storage_format() const { return storage; }
+
+    static bvh_layout build_layout(const mesh& geometry, const bvh_build_options& options) {
+        // The BVH over the mesh's triangles, with SBVH splits clipping the triangles themselves.
+        int n = static_cast<int>(geometry.triangle_count());
+        std::vector<aabb> bounds(n);
+        for (int k = 0; k < n; ++k) {
+            point3 v0, v1, v2;
+            geometry.triangle_vertices(k, v0, v1, v2);
+            bounds[k] = triangle_bounds(v0, v1, v2);
+        }
+        auto clip = [&geometry](int k, const aabb& box) {
+            point3 v0, v1, v2;
+            geometry.triangle_vertices(k, v0, v1, v2);
+            return clipped_triangle_bounds(v0, v1, v2, box);
+        };
+        return bvh_layout(build_bvh(bounds, options, clip), options.width);
+    }
+
+    size_t memory_bytes() const {
+        // Bytes of the vertex, index, BVH and batch buffers, whether owned or mapped.
+        size_t nodes = (tree.width == 8) ? tree.wide8.nodes.size() * sizeof(wide_bvh_node<8>)
+                     : (tree.width == 4) ? tree.wide4.nodes.size() * sizeof(wide_bvh_node<4>)
+                     : tree.binary.nodes.size() * sizeof(linear_bvh_node);
+        return 3 * geometry.vertex_count() * sizeof(double) + geometry.indices.size() * sizeof(int)
+             + tree.order().size() * sizeof(int) + nodes
+             + batches.size() * sizeof(triangle_batch) + packed.memory_bytes();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (format == mesh_leaf_format::indexed)
+            return intersect(r, ray_t, rec, triangle_leaf{ this });
+        watertight_ray prepared(r);
+        return intersect(r, ray_t, rec, batch_leaf{ this, &prepared });
+    }
+
+    void hit_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const override {
+        if (format == mesh_leaf_format::indexed) {
+            tree.intersect_packet(packet, active, t_min, hits, triangle_leaf{ this },
+                [&](int first, int count, uint32_t mask) {
+                    for (int k = first; k < first + count; ++k)
+                        hit_triangle_packet(tree.order()[k], packet, mask, t_min, hits);
+                });
+            return;
+        }
+        // Batches hold the triangles of a leaf side by side rather than the lanes of a packet,
+        // so each lane runs the batch kernel on its own, with its ray prepared once.
+        watertight_ray prepared[packet_size];
+        for (int l = 0; l < packet_size; ++l)
+            if (active & (1u << l))
+                prepared[l] = watertight_ray(packet.lane_ray(l));
+        tree.intersect_packet(packet, active, t_min, hits, batch_leaf{ this, nullptr },
+            [&](int first, int count, uint32_t mask) {
+                for (int l = 0; l < packet_size; ++l) {
+                    if (!(mask & (1u << l))) continue;
+                    interval ray_t(t_min, hits.t[l]);
+                    hit_record rec;
+                    if (hit_batches(packet.lane_ray(l), prepared[l], first, count, ray_t, rec))
+                        hits.record(l, rec);
+                }
+            });
+    }
+
+    aabb bounding_box() const override { return tree.bbox; }
+
+private:
+    mesh geometry; // Empty if the storage is compressed
+    std::shared_ptr<material> mat;
+    bvh_layout tree;
+    mesh_leaf_format format = mesh_leaf_format::batched;
+    mesh_storage storage = mesh_storage::full;
+    compressed_mesh packed; // The triangles if the storage is compressed
+    std::vector<triangle_batch> batches; // Vertices of order[4 * i, 4 * i + 4) in batch i
+
+    template <typename Leaf>
+    bool intersect(const ray& r, interval ray_t, hit_record& rec, Leaf leaf) const {
+        if (tree.width == 8)
+            return tree.wide8.intersect(r, ray_t, rec, leaf);
+        if (tree.width == 4)
+            return tree.wide4.intersect(r, ray_t, rec, leaf);
+        return tree.binary.intersect(r, ray_t, rec, leaf);
+    }
+
+    void triangle_vertices(int k, point3& v0, point3& v1, point3& v2) const {
+        if (storage == mesh_storage::full)
+            geometry.triangle_vertices(k, v0, v1, v2);
+        else
+            packed.triangle_vertices(k, v0, v1, v2);
+    }
+
+    void compress() {
+        if (storage == mesh_storage::full)
+            return;
+        packed = compressed_mesh(geometry, storage);
+        geometry = mesh();
+        const shared_array<int>& order = tree.order();
+        std::vector<aabb> boxes(order.size());
+        for (size_t k = 0; k < order.size(); ++k) {
+            point3 v0, v1, v2;
+            packed.triangle_vertices(order[k], v0, v1, v2);
+            boxes[k] = triangle_bounds(v0, v1, v2);
+        }
+        if (!boxes.empty())
+            tree.refit(boxes);
+    }
+
+    void build_batches() {
+        if (format != mesh_leaf_format::batched || storage != mesh_storage::full)
+            return;
+        const shared_array<int>& order = tree.order();
+        batches.assign((order.size() + triangle_batch_size - 1) / triangle_batch_size, triangle_batch());
+        for (size_t k = 0; k < order.size(); ++k)
+            fill_batch_slot(batches[k / triangle_batch_size], static_cast<int>(k % triangle_batch_size), order[k]);
+    }
+
+    void fill_batch_slot(triangle_batch& batch, int i, int triangle) const {
+        point3 v[3];
+        triangle_vertices(triangle, v[0], v[1], v[2]);
+        for (int a = 0; a < 3; ++a) {
+            batch.a[a][i] = v[0][a];
+            batch.b[a][i] = v[1][a];
+            batch.c[a][i] = v[2][a];
+        }
+    }
+
+    void record_hit(const ray& r, int k, double t, double u, double v, hit_record& rec) const {
+        point3 v0, v1, v2;
+        triangle_vertices(k, v0, v1, v2);
+        rec.set_face_normal(r, unit_vector(cross(v1 - v0, v2 - v0)));
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = mat;
+        rec.u = u;
+        rec.v = v;
+        triangle_texture_uv(rec.u, rec.v);
+        STAT_COUNT(primitive_hits);
+    }
+
+    void hit_triangle_packet(int k, const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits) const {
+        point3 v0, v1, v2;
+        triangle_vertices(k, v0, v1, v2);
+        double t[packet_size], u[packet_size], v[packet_size];
+        bool valid[packet_size];
+        intersect_triangle_packet(packet, v0, v1, v2, t_min, hits.t, t, u, v, valid);
+        for (int l = 0; l < packet_size; ++l) {
+            if (!(active & (1u << l))) continue;
+            STAT_COUNT(triangle_tests);
+            if (!valid[l]) continue;
+            hit_record rec;
+            record_hit(packet.lane_ray(l), k, t[l], u[l], v[l], rec);
+            hits.record(l, rec);
+        }
+    }
+
+    bool hit_batches(const ray& r, const watertight_ray& prepared, int first, int count, interval& ray_t,
+                     hit_record& rec) const {
+        // Closest hit among the triangles at order[first, first + count). The batches holding
+        // them may hold triangles of neighbouring leaves too; those slots are masked out. A
+        // compressed mesh has no batches, so the leaf's triangles are decoded into one, four at a
+        // time, with unused slots repeating the last triangle.
+        bool decode = (storage != mesh_storage::full);
+        const shared_array<int>& order = tree.order();
+        int end = first + count;
+        int closest = -1;
+        double closest_u = 0, closest_v = 0;
+        int start = decode ? first : first - first % triangle_batch_size;
+        for (int base = start; base < end; base += triangle_batch_size) {
+            int from = std::max(first, base) - base, to = std::min(end, base + triangle_batch_size) - base;
+            uint32_t slots = ((1u << to) - 1) & ~((1u << from) - 1);
+            STAT_ADD(triangle_tests, to - from);
+            triangle_batch decoded;
+            if (decode) {
+                for (int i = 0; i < triangle_batch_size; ++i)
+                    fill_batch_slot(decoded, i, order[base + std::min(i, to - 1)]);
+            }
+            const triangle_batch& batch = decode ? decoded : batches[base / triangle_batch_size];
+            double t[triangle_batch_size], u[triangle_batch_size], v[triangle_batch_size];
+            uint32_t mask = intersect_triangle_batch(batch, slots, prepared, ray_t, t, u, v);
+            for (int i = 0; mask != 0; ++i, mask >>= 1) {
+                if ((mask & 1u) && t[i] <= ray_t.max) {
+                    closest = base + i;
+                    closest_u = u[i];
+                    closest_v = v[i];
+                    ray_t.max = t[i];
+                }
+            }
+        }
+        if (closest < 0)
+            return false;
+        record_hit(r, order[closest], ray_t.max, closest_u, closest_v, rec);
+        return true;
+    }
+
+    struct batch_leaf {
+        // Scalar leaf test over the batches. `prepared` is the traversal's ray already set up for
+        // the kernel; without it (the per-lane fallback of packet traversal) it is set up here.
+        const triangle_mesh* self;
+        const watertight_ray* prepared;
+
+        bool operator()(const ray& r, int first, int count, interval& ray_t, hit_record& rec) const {
+            if (prepared)
+                return self->hit_batches(r, *prepared, first, count, ray_t, rec);
+            return self->hit_batches(r, watertight_ray(r), first, count, ray_t, rec);
+        }
+    };
+
+    struct triangle_leaf {
+        // Scalar leaf test for the traversals: the closest hit among a leaf's triangles. The hit
+        // record is filled in once, for the closest one.
+        const triangle_mesh* self;
+
+        bool operator()(const ray& r, int first, int count, interval& ray_t, hit_record& rec) const {
+            const shared_array<int>& order = self->tree.order();
+            int closest = -1;
+            double closest_u = 0, closest_v = 0;
+            for (int k = first; k < first + count; ++k) {
+                point3 v0, v1, v2;
+                self->triangle_vertices(order[k], v0, v1, v2);
+                double t, u, v;
+                if (intersect_triangle(r, v0, v1, v2, ray_t, t, u, v)) {
+                    closest = order[k];
+                    closest_u = u;
+                    closest_v = v;
+                    ray_t.max = t;
+                }
+            }
+            if (closest < 0)
+                return false;
+            self->record_hit(r, closest, ray_t.max, closest_u, closest_v, rec);
+            return true;
+        }
+    };
+};
+
+#endif // TRIANGLE_MESH_H
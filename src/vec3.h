@@ -115,6 +115,24 @@ inline vec3 random_in_unit_disk() {
     }
 }
 
+inline vec3 sample_unit_disk(double u, double v) {
+    // Maps a point of the unit square to the unit disk with Shirley's concentric mapping, which
+    // keeps the stratification of well-distributed samples.
+    double a = 2 * u - 1;
+    double b = 2 * v - 1;
+    if (a == 0 && b == 0)
+        return vec3(0, 0, 0);
+    double r, phi;
+    if (a * a > b * b) {
+        r = a;
+        phi = (pi / 4) * (b / a);
+    } else {
+        r = b;
+        phi = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(r * cos(phi), r * sin(phi), 0);
+}
+
 inline vec3 random_in_unit_sphere() {
     while (true) {
         auto p = vec3::random(-1, 1);
@@ -136,8 +154,8 @@ inline vec3 random_on_hemisphere(const vec3& normal) {
 }
 
 inline vec3 random_cosine_direction() {
-    double r1 = random_double();
-    double r2 = random_double();
+    double r1, r2;
+    sample_2d(r1, r2);
 
     double phi = 2 * pi * r1;
     double x = cos(phi) * sqrt(r2);
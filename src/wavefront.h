@@ -0,0 +1,311 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "film.h"
+#include "hittable.h"
+#include "material.h"
+#include "parallel.h"
+#include "pdf.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+class path_buffer {
+public:
+    // Structure-of-arrays state for every path in flight: each stage streams through the few
+    // arrays it needs instead of dragging whole path records through the cache.
+    std::vector<int> pixel, depth;
+    std::vector<double> ox, oy, oz, dx, dy, dz, time; // Current ray
+    std::vector<double> beta_r, beta_g, beta_b; // Path throughput
+    std::vector<double> l_r, l_g, l_b; // Radiance gathered so far
+    std::vector<thread_random_state> random; // Random generator and sampler state, carried from stage to stage
+
+    // Closest hit of the current ray
+    std::vector<double> px, py, pz, nx, ny, nz, hit_u, hit_v, hit_t;
+    std::vector<char> front_face;
+    std::vector<const material*> mat;
+
+    void resize(size_t n) {
+        for (auto* v : { &pixel, &depth }) v->resize(n);
+        for (auto* v : { &ox, &oy, &oz, &dx, &dy, &dz, &time, &beta_r, &beta_g, &beta_b, &l_r, &l_g, &l_b,
+                         &px, &py, &pz, &nx, &ny, &nz, &hit_u, &hit_v, &hit_t })
+            v->resize(n);
+        random.resize(n);
+        front_face.resize(n);
+        mat.resize(n);
+    }
+
+    ray get_ray(int k) const { return ray(point3(ox[k], oy[k], oz[k]), vec3(dx[k], dy[k], dz[k]), time[k]); }
+
+    void set_ray(int k, const ray& r) {
+        ox[k] = r.origin().x(); oy[k] = r.origin().y(); oz[k] = r.origin().z();
+        dx[k] = r.direction().x(); dy[k] = r.direction().y(); dz[k] = r.direction().z();
+        time[k] = r.time();
+    }
+
+    color throughput(int k) const { return color(beta_r[k], beta_g[k], beta_b[k]); }
+
+    void set_throughput(int k, const color& c) { beta_r[k] = c.x(); beta_g[k] = c.y(); beta_b[k] = c.z(); }
+
+    void add_radiance(int k, const color& c) { l_r[k] += c.x(); l_g[k] += c.y(); l_b[k] += c.z(); }
+
+    color radiance(int k) const { return color(l_r[k], l_g[k], l_b[k]); }
+
+    void set_hit(int k, const hit_record& rec) {
+        px[k] = rec.p.x(); py[k] = rec.p.y(); pz[k] = rec.p.z();
+        nx[k] = rec.normal.x(); ny[k] = rec.normal.y(); nz[k] = rec.normal.z();
+        hit_u[k] = rec.u; hit_v[k] = rec.v; hit_t[k] = rec.t;
+        front_face[k] = rec.front_face;
+        mat[k] = rec.mat.get();
+    }
+
+    hit_record get_hit(int k) const {
+        // The record's material pointer is left empty; stages call through mat[k] instead.
+        hit_record rec;
+        rec.p = point3(px[k], py[k], pz[k]);
+        rec.normal = vec3(nx[k], ny[k], nz[k]);
+        rec.u = hit_u[k]; rec.v = hit_v[k]; rec.t = hit_t[k];
+        rec.front_face = front_face[k];
+        return rec;
+    }
+
+    void load_random(int k) const { thread_random() = random[k]; }
+
+    void store_random(int k) { random[k] = thread_random(); }
+};
+
+class wavefront_integrator {
+public:
+    // Path tracer that advances a large batch of paths one bounce at a time, stage by stage:
+    // generate camera rays, intersect, sort by material, shade, then compact away the finished
+    // paths. It performs the same operations on the same random streams as camera::ray_color, so
+    // it renders the same image as a jittered (progressive) render of the same seed.
+    //
+    // The integrator samples lights through the mixture pdf rather than with separate shadow
+    // connections, so light-geometry tests happen inside the shade stage.
+    int num_threads = 0; // Worker threads (0 uses every hardware thread)
+    int max_paths = 1 << 20; // Paths in flight per batch
+    int max_depth = 10;
+    int rr_start_depth = 5;
+    double rr_min_survival = 0.05;
+    color background;
+    const sampler* pixel_sampler = nullptr; // Sample pattern (nullptr draws independent random numbers)
+
+    template <typename CameraRay>
+    void render(film& image, int samples_per_pixel, uint64_t seed,
+                const hittable& world, const hittable& lights, const CameraRay& camera_ray) {
+        // camera_ray(i, j) must return a camera ray for pixel i, j, drawing its samples from the
+        // calling thread's random state.
+        int spp = std::max(samples_per_pixel, 1);
+        int pixels_per_batch = std::max(max_paths / spp, 1);
+        int pixel_count = image.pixel_count();
+        int width = image.width();
+
+        for (int first_pixel = 0; first_pixel < pixel_count; first_pixel += pixels_per_batch) {
+            int batch_pixels = std::min(pixels_per_batch, pixel_count - first_pixel);
+            int path_count = batch_pixels * spp;
+            paths.resize(path_count);
+
+            timed(generate_stage, path_count, [&] {
+                for_each_chunk(path_count, [&](int k) {
+                    int pixel = first_pixel + k / spp;
+                    start_pixel_sample(pixel_sampler, seed, pixel % width, pixel / width, width, k % spp);
+                    paths.pixel[k] = pixel;
+                    paths.depth[k] = 0;
+                    paths.set_ray(k, camera_ray(pixel % width, pixel / width));
+                    STAT_COUNT(camera_rays);
+                    paths.set_throughput(k, color(1, 1, 1));
+                    paths.l_r[k] = paths.l_g[k] = paths.l_b[k] = 0.0;
+                    paths.store_random(k);
+                });
+            });
+
+            active.resize(path_count);
+            for (int k = 0; k < path_count; ++k)
+                active[k] = k;
+
+            while (!active.empty())
+                trace_bounce(world, lights);
+
+            // Paths of a pixel are contiguous and in sample order, so the sums match a scalar render.
+            for (int p = 0; p < batch_pixels; ++p) {
+                color sum(0, 0, 0);
+                double luminance_sq_sum = 0.0;
+                for (int s = 0; s < spp; ++s) {
+                    color c = zero_nan(paths.radiance(p * spp + s));
+                    sum += c;
+                    luminance_sq_sum += luminance(c) * luminance(c);
+                }
+                int pixel = first_pixel + p;
+                image.add(pixel % width, pixel / width, sum, luminance_sq_sum, spp);
+            }
+        }
+    }
+
+    long long rays_traced() const { return intersect_stage.items; }
+
+    void report(std::ostream& out) const {
+        // Prints the work done and throughput of every stage.
+        const stage_stats* stages[] = { &generate_stage, &intersect_stage, &sort_stage, &shade_stage, &compact_stage };
+        const char* names[] = { "generate", "intersect", "sort", "shade", "compact" };
+        std::streamsize precision = out.precision();
+        out << "Wavefront stages:\n";
+        for (int s = 0; s < 5; ++s) {
+            double rate = stages[s]->seconds > 0 ? stages[s]->items / stages[s]->seconds / 1e6 : 0.0;
+            out << "  " << std::left << std::setw(10) << names[s] << std::right
+                << std::setw(14) << stages[s]->items << " items "
+                << std::fixed << std::setprecision(3) << std::setw(10) << stages[s]->seconds << " s "
+                << std::setprecision(2) << std::setw(10) << rate << " M/s\n";
+        }
+        out.unsetf(std::ios::floatfield);
+        out.precision(precision);
+    }
+
+private:
+    struct stage_stats {
+        long long items = 0;
+        double seconds = 0.0;
+    };
+
+    path_buffer paths;
+    std::vector<int> active; // Indices of live paths, in path order
+    std::vector<int> hits; // Live paths that hit something this bounce, sorted by material
+    std::vector<char> alive;
+    stage_stats generate_stage, intersect_stage, sort_stage, shade_stage, compact_stage;
+
+    template <typename Body>
+    void timed(stage_stats& stage, long long items, const Body& body) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        stage.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stage.items += items;
+    }
+
+    template <typename Body>
+    void for_each_chunk(int count, const Body& body) const {
+        const int chunk_size = 1024;
+        int chunks = (count + chunk_size - 1) / chunk_size;
+        parallel_for(chunks, num_threads, [&](int c, int) {
+            int end = std::min(count, (c + 1) * chunk_size);
+            for (int k = c * chunk_size; k < end; ++k)
+                body(k);
+        });
+    }
+
+    void trace_bounce(const hittable& world, const hittable& lights) {
+        int live = static_cast<int>(active.size());
+        alive.assign(paths.pixel.size(), 0);
+
+        // Extension rays: find the closest hit of every live path. Misses pick up the background
+        // and finish here.
+        timed(intersect_stage, live, [&] {
+            for_each_chunk(live, [&](int a) {
+                int k = active[a];
+                paths.load_random(k);
+                start_random_bounce(paths.depth[k]);
+                STAT_COUNT(extension_rays);
+
+                hit_record rec;
+                if (world.hit(paths.get_ray(k), interval(0.001, infinity), rec)) {
+                    paths.set_hit(k, rec);
+                    alive[k] = 1;
+                } else {
+                    paths.add_radiance(k, paths.throughput(k) * background);
+                    STAT_HISTOGRAM(path_bounces, paths.depth[k] + 1);
+                }
+                paths.store_random(k);
+            });
+        });
+
+        // Bin the hits by material so the shade stage runs the same scatter code back to back.
+        timed(sort_stage, live, [&] {
+            hits.clear();
+            for (int k : active)
+                if (alive[k]) hits.push_back(k);
+            std::stable_sort(hits.begin(), hits.end(), [&](int a, int b) {
+                return std::less<const material*>()(paths.mat[a], paths.mat[b]);
+            });
+        });
+
+        int hit_count = static_cast<int>(hits.size());
+        timed(shade_stage, hit_count, [&] {
+            for_each_chunk(hit_count, [&](int h) {
+                int k = hits[h];
+                paths.load_random(k);
+                alive[k] = shade(k, lights);
+                paths.store_random(k);
+            });
+        });
+
+        timed(compact_stage, live, [&] {
+            active.erase(std::remove_if(active.begin(), active.end(), [&](int k) { return !alive[k]; }),
+                         active.end());
+        });
+    }
+
+    bool shade(int k, const hittable& lights) {
+        // Adds emission, scatters, and applies Russian roulette for path k. Returns false if the
+        // path ends here. Mirrors the body of camera::ray_color.
+        ray r = paths.get_ray(k);
+        hit_record rec = paths.get_hit(k);
+        const material* mat = paths.mat[k];
+        color throughput = paths.throughput(k);
+
+        paths.add_radiance(k, throughput * mat->emitted(r, rec, rec.u, rec.v, rec.p));
+
+        scatter_record srec;
+        if (!mat->scatter(r, rec, srec)) {
+            STAT_HISTOGRAM(path_bounces, paths.depth[k] + 1);
+            return false;
+        }
+
+        if (srec.skip_pdf) {
+            STAT_COUNT(skip_pdf_scatters);
+            throughput = throughput * srec.attenuation;
+            r = srec.skip_pdf_ray;
+        } else {
+            STAT_COUNT(pdf_scatters);
+            auto light_ptr = std::make_shared<hittable_pdf>(lights, rec.p);
+            mixture_pdf mixed_pdf(light_ptr, srec.pdf_ptr);
+
+            ray scattered = ray(rec.p, mixed_pdf.generate(), r.time());
+            double pdf_val = mixed_pdf.value(scattered.direction());
+
+            double scattering_pdf = mat->scattering_pdf(r, rec, scattered);
+
+            throughput = throughput * srec.attenuation * scattering_pdf / pdf_val;
+            r = scattered;
+        }
+
+        int bounce = paths.depth[k]++;
+        if (bounce + 1 >= rr_start_depth) {
+            double survival = fmax(throughput.x(), fmax(throughput.y(), throughput.z()));
+            survival = interval(rr_min_survival, 1.0).clamp(survival);
+            if (sample_1d() >= survival) {
+                STAT_COUNT(roulette_terminations);
+                STAT_HISTOGRAM(path_bounces, paths.depth[k]);
+                return false;
+            }
+            throughput /= survival;
+        }
+
+        paths.set_throughput(k, throughput);
+        paths.set_ray(k, r);
+        if (paths.depth[k] < max_depth)
+            return true;
+        STAT_COUNT(max_depth_paths);
+        STAT_HISTOGRAM(path_bounces, max_depth);
+        return false;
+    }
+};
+
+#endif // WAVEFRONT_H
\ No newline at end of file
@@ -0,0 +1,447 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "rtweekend.h"
+
+#include "bvh_build.h"
+#include "mapped_file.h"
+#include "packet.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+template <int N>
+struct alignas(64) wide_bvh_node {
+    // A node with up to N children whose boxes are stored side by side (structure of arrays), so
+    // one SIMD slab test checks them all. Bounds are floats rounded outward; unused slots have an
+    // empty box, which no ray enters.
+    float bounds[6][N]; // Per child: min x, y, z, then max x, y, z
+    uint32_t child[N]; // Interior child: node index. Leaf child: first entry of the primitive order
+    uint16_t count[N]; // Primitives of a leaf child, 0 for interior children and unused slots
+};
+
+struct wide_bvh_ray {
+    // A ray prepared once for a whole traversal: its inverse direction, and per axis whether the
+    // direction is negative, which picks the near and far planes of every box without a swap.
+    double origin[3];
+    double inv_dir[3];
+    int negative[3];
+
+    wide_bvh_ray() {}
+
+    explicit wide_bvh_ray(const ray& r) {
+        for (int a = 0; a < 3; ++a) {
+            origin[a] = r.origin()[a];
+            inv_dir[a] = 1 / r.direction()[a];
+            negative[a] = inv_dir[a] < 0;
+        }
+    }
+};
+
+template <int N>
+class wide_bvh {
+  public:
+    // A binary BVH collapsed into an N-wide one (N = 4 or 8): each node takes the children of
+    // its binary subtree, repeatedly opening the interior child with the largest surface area
+    // until N children are collected. Traversal tests all children of a node at once and visits
+    // the hit ones nearest first; like linear_bvh, leaves are tested through a callback.
+    static_assert(N == 4 || N == 8, "wide_bvh supports 4 or 8 children per node");
+
+    shared_array<wide_bvh_node<N>> nodes; // Root at index 0
+    shared_array<int> order; // Primitive indices in leaf order; leaves refer to ranges of it
+    int depth = 0; // Longest root-to-leaf path, which bounds the traversal stack
+
+    wide_bvh() {}
+
+    explicit wide_bvh(const bvh_build_result& tree) : order(tree.order) {
+        if (tree.nodes.empty())
+            return;
+        std::vector<wide_bvh_node<N>> wide;
+        wide.reserve(tree.nodes.size() / (N - 1) + 1);
+        if (tree.nodes[0].count > 0) {
+            // A single leaf: the root holds it in its first slot.
+            wide.push_back(empty_node());
+            set_slot(wide[0], 0, tree.nodes[0]);
+            depth = 1;
+        } else {
+            depth = collapse(wide, tree, 0);
+        }
+        nodes = std::move(wide);
+    }
+
+    wide_bvh(shared_array<wide_bvh_node<N>> nodes, shared_array<int> order, int depth)
+        : nodes(std::move(nodes)), order(std::move(order)), depth(depth) {}
+
+    void refit(const std::vector<aabb>& boxes) {
+        // Recomputes every child box from boxes[k], the current bounds of the primitive at
+        // order[k], keeping the topology, as linear_bvh::refit does. Child nodes are appended
+        // after their parent, so a reverse pass updates them first.
+        std::vector<wide_bvh_node<N>> updated = nodes.to_vector();
+        for (int i = static_cast<int>(updated.size()) - 1; i >= 0; --i) {
+            wide_bvh_node<N>& node = updated[i];
+            for (int slot = 0; slot < N; ++slot) {
+                if (node.count[slot] > 0) {
+                    aabb box = aabb::empty;
+                    for (int k = 0; k < node.count[slot]; ++k)
+                        box = aabb(box, boxes[node.child[slot] + k]);
+                    for (int a = 0; a < 3; ++a) {
+                        node.bounds[a][slot] = round_down_to_float(box.axis(a).min);
+                        node.bounds[a + 3][slot] = round_up_to_float(box.axis(a).max);
+                    }
+                } else if (node.child[slot] != 0) {
+                    // An interior child; unused slots point at the root, which is no one's child.
+                    const wide_bvh_node<N>& child = updated[node.child[slot]];
+                    for (int a = 0; a < 3; ++a) {
+                        node.bounds[a][slot] = *std::min_element(child.bounds[a], child.bounds[a] + N);
+                        node.bounds[a + 3][slot] = *std::max_element(child.bounds[a + 3], child.bounds[a + 3] + N);
+                    }
+                }
+            }
+        }
+        nodes = std::move(updated);
+    }
+
+    double sah_cost(double traversal_cost) const {
+        // Expected cost of a ray that hits the root: a node visit costs traversal_cost and a leaf
+        // its primitive count, each weighted by the area of its box relative to the root's.
+        if (nodes.empty())
+            return 0.0;
+        aabb root = aabb::empty;
+        for (int slot = 0; slot < N; ++slot)
+            root = aabb(root, slot_box(nodes[0], slot));
+        double root_area = fmax(surface_area(root), 1e-300);
+        double cost = root_area * traversal_cost;
+        for (const wide_bvh_node<N>& node : nodes) {
+            for (int slot = 0; slot < N; ++slot) {
+                if (node.count[slot] > 0)
+                    cost += surface_area(slot_box(node, slot)) * node.count[slot];
+                else if (node.child[slot] != 0)
+                    cost += surface_area(slot_box(node, slot)) * traversal_cost;
+            }
+        }
+        return cost / root_area;
+    }
+
+    template <typename Visit>
+    void for_each_leaf(Visit&& visit) const {
+        // Calls visit(first, count) for every leaf child, in node order.
+        for (const wide_bvh_node<N>& node : nodes)
+            for (int slot = 0; slot < N; ++slot)
+                if (node.count[slot] > 0)
+                    visit(static_cast<int>(node.child[slot]), static_cast<int>(node.count[slot]));
+    }
+
+    template <typename LeafHit>
+    bool intersect(const ray& r, interval ray_t, hit_record& rec, LeafHit&& leaf_hit, uint32_t start = 0) const {
+        // Closest hit below node `start`, with leaf_hit(r, first, count, ray_t, rec) as in
+        // linear_bvh::intersect. Stack entries keep the distance at which the ray enters them, so
+        // entries beyond the closest hit found meanwhile are dropped without another box test.
+        if (nodes.empty())
+            return false;
+
+        struct entry {
+            uint32_t child;
+            uint32_t count;
+            double t_near;
+        };
+
+        const wide_bvh_ray prepared(r);
+        int capacity = depth * (N - 1) + 1;
+        entry local_stack[stack_capacity];
+        std::vector<entry> heap_stack;
+        entry* stack = local_stack;
+        if (capacity > stack_capacity) {
+            heap_stack.resize(capacity);
+            stack = heap_stack.data();
+        }
+
+        bool hit_anything = false;
+        int top = 0;
+        stack[top++] = { start, 0, -infinity };
+        while (top > 0) {
+            entry e = stack[--top];
+            if (e.t_near >= ray_t.max)
+                continue;
+
+            if (e.count > 0) {
+                if (leaf_hit(r, static_cast<int>(e.child), static_cast<int>(e.count), ray_t, rec))
+                    hit_anything = true;
+                continue;
+            }
+
+            STAT_COUNT(bvh_node_visits);
+            const wide_bvh_node<N>& node = nodes[e.child];
+            double t_near[N];
+            uint32_t mask = hit_children(node, prepared, ray_t, t_near);
+
+            // Push the hit children farthest first, so the nearest is visited next.
+            int slots[N], n = 0;
+            for (; mask; mask &= mask - 1) {
+                int slot = lowest_bit(mask);
+                int k = n++;
+                while (k > 0 && t_near[slots[k - 1]] < t_near[slot]) {
+                    slots[k] = slots[k - 1];
+                    --k;
+                }
+                slots[k] = slot;
+            }
+            for (int k = 0; k < n; ++k)
+                stack[top++] = { node.child[slots[k]], node.count[slots[k]], t_near[slots[k]] };
+        }
+        return hit_anything;
+    }
+
+    template <typename LeafHit, typename LeafPacket>
+    void intersect_packet(const ray_packet& packet, uint32_t active, double t_min, packet_hits& hits,
+                          LeafHit&& leaf_hit, LeafPacket&& leaf_packet) const {
+        // Packet traversal with the callbacks of linear_bvh::intersect_packet. At a node, each
+        // lane tests all N child boxes with one multi-box test, and every child entered by some
+        // lane is pushed with the mask of those lanes, nearest first for the first lane. As in
+        // linear_bvh, once few lanes remain they continue one at a time through the subtree.
+        struct entry {
+            uint32_t child;
+            uint32_t count;
+            uint32_t mask;
+            double t_near[packet_size]; // Where each lane enters the child
+        };
+
+        if (nodes.empty() || active == 0)
+            return;
+
+        wide_bvh_ray lanes[packet_size];
+        for (int l = 0; l < packet_size; ++l)
+            if (active & (1u << l))
+                lanes[l] = wide_bvh_ray(packet.lane_ray(l));
+
+        int capacity = depth * (N - 1) + 1;
+        entry local_stack[packet_stack_capacity];
+        std::vector<entry> heap_stack;
+        entry* stack = local_stack;
+        if (capacity > packet_stack_capacity) {
+            heap_stack.resize(capacity);
+            stack = heap_stack.data();
+        }
+
+        int top = 0;
+        stack[top].child = 0;
+        stack[top].count = 0;
+        stack[top].mask = active;
+        std::fill(stack[top].t_near, stack[top].t_near + packet_size, -infinity);
+        ++top;
+        while (top > 0) {
+            entry& e = stack[--top];
+            // Lanes that have meanwhile found a hit nearer than the child drop out.
+            for (int l = 0; l < packet_size; ++l)
+                if (e.t_near[l] >= hits.t[l])
+                    e.mask &= ~(1u << l);
+
+            if (lane_count(e.mask) <= packet_fallback_lanes) {
+                for (int l = 0; l < packet_size; ++l) {
+                    if (!(e.mask & (1u << l))) continue;
+                    ray r = packet.lane_ray(l);
+                    interval ray_t(t_min, hits.t[l]);
+                    hit_record rec;
+                    bool hit = (e.count > 0)
+                             ? leaf_hit(r, static_cast<int>(e.child), static_cast<int>(e.count), ray_t, rec)
+                             : intersect(r, ray_t, rec, leaf_hit, e.child);
+                    if (hit)
+                        hits.record(l, rec);
+                }
+                continue;
+            }
+
+            if (e.count > 0) {
+                leaf_packet(static_cast<int>(e.child), static_cast<int>(e.count), e.mask);
+                continue;
+            }
+
+            STAT_COUNT(packet_node_visits);
+            const wide_bvh_node<N>& node = nodes[e.child];
+            uint32_t lanes_in = e.mask; // The first child pushed overwrites e
+            uint32_t child_lanes[N] = {};
+            double t_near[packet_size][N];
+            for (int l = 0; l < packet_size; ++l) {
+                if (!(lanes_in & (1u << l))) {
+                    std::fill(t_near[l], t_near[l] + N, infinity);
+                    continue;
+                }
+                uint32_t hit = hit_children(node, lanes[l], interval(t_min, hits.t[l]), t_near[l]);
+                for (int slot = 0; slot < N; ++slot)
+                    child_lanes[slot] |= ((hit >> slot) & 1u) << l;
+            }
+            // Children the first lane misses go last.
+            int first = lowest_bit(lanes_in);
+            double order_key[N];
+            for (int slot = 0; slot < N; ++slot)
+                order_key[slot] = (child_lanes[slot] & (1u << first)) ? t_near[first][slot] : infinity;
+
+            // Push the entered children farthest first, so the nearest is visited next.
+            int slots[N], n = 0;
+            for (int slot = 0; slot < N; ++slot) {
+                if (!child_lanes[slot]) continue;
+                int k = n++;
+                while (k > 0 && order_key[slots[k - 1]] < order_key[slot]) {
+                    slots[k] = slots[k - 1];
+                    --k;
+                }
+                slots[k] = slot;
+            }
+            for (int k = 0; k < n; ++k) {
+                entry& child = stack[top++];
+                int slot = slots[k];
+                child.child = node.child[slot];
+                child.count = node.count[slot];
+                child.mask = child_lanes[slot];
+                for (int l = 0; l < packet_size; ++l)
+                    child.t_near[l] = t_near[l][slot];
+            }
+        }
+    }
+
+  private:
+    static const int stack_capacity = 256; // Deeper trees fall back to a heap allocated stack
+    static const int packet_stack_capacity = 64; // The same for packet traversal, whose entries are larger
+
+    static int lowest_bit(uint32_t mask) {
+        int bit = 0;
+        while (!(mask & 1u)) {
+            mask >>= 1;
+            ++bit;
+        }
+        return bit;
+    }
+
+    static aabb slot_box(const wide_bvh_node<N>& node, int slot) {
+        aabb box;
+        box.x = interval(node.bounds[0][slot], node.bounds[3][slot]);
+        box.y = interval(node.bounds[1][slot], node.bounds[4][slot]);
+        box.z = interval(node.bounds[2][slot], node.bounds[5][slot]);
+        return box;
+    }
+
+    static wide_bvh_node<N> empty_node() {
+        wide_bvh_node<N> node;
+        for (int i = 0; i < N; ++i) {
+            for (int a = 0; a < 3; ++a) {
+                node.bounds[a][i] = std::numeric_limits<float>::infinity();
+                node.bounds[a + 3][i] = -std::numeric_limits<float>::infinity();
+            }
+            node.child[i] = 0;
+            node.count[i] = 0;
+        }
+        return node;
+    }
+
+    static void set_slot(wide_bvh_node<N>& node, int slot, const bvh_build_node& source) {
+        for (int a = 0; a < 3; ++a) {
+            node.bounds[a][slot] = round_down_to_float(source.bbox.axis(a).min);
+            node.bounds[a + 3][slot] = round_up_to_float(source.bbox.axis(a).max);
+        }
+        node.child[slot] = static_cast<uint32_t>(source.first);
+        node.count[slot] = static_cast<uint16_t>(source.count);
+    }
+
+    static int collapse(std::vector<wide_bvh_node<N>>& out, const bvh_build_result& tree, int index) {
+        // Appends a wide node for interior binary node `index` and its subtree; returns the depth
+        // of the wide subtree.
+        int children[N];
+        int n = 0;
+        children[n++] = tree.nodes[index].left;
+        children[n++] = tree.nodes[index].right;
+        while (n < N) {
+            int widest = -1;
+            double widest_area = -1;
+            for (int k = 0; k < n; ++k) {
+                const bvh_build_node& c = tree.nodes[children[k]];
+                double area = surface_area(c.bbox);
+                if (c.count == 0 && area > widest_area) {
+                    widest = k;
+                    widest_area = area;
+                }
+            }
+            if (widest < 0)
+                break;
+            int opened = children[widest];
+            children[widest] = tree.nodes[opened].left;
+            children[n++] = tree.nodes[opened].right;
+        }
+
+        int position = static_cast<int>(out.size());
+        out.push_back(empty_node());
+        int subtree_depth = 0;
+        for (int k = 0; k < n; ++k) {
+            const bvh_build_node& c = tree.nodes[children[k]];
+            set_slot(out[position], k, c);
+            if (c.count == 0) {
+                uint32_t child_index = static_cast<uint32_t>(out.size());
+                subtree_depth = std::max(subtree_depth, collapse(out, tree, children[k]));
+                out[position].child[k] = child_index;
+            }
+        }
+        return subtree_depth + 1;
+    }
+
+    static uint32_t hit_children(const wide_bvh_node<N>& node, const wide_bvh_ray& r, interval ray_t, double* t_near) {
+        // Slab test of the ray against every child box; returns the mask of children entered
+        // within ray_t and stores the entry distances. Like aabb::hit, a NaN from a zero direction
+        // component lying in a slab plane leaves the interval unchanged.
+        STAT_COUNT(aabb_tests);
+        uint32_t mask = 0;
+
+#if defined(RT_PACKET_AVX)
+        for (int g = 0; g < N; g += 4) {
+            __m256d entry = _mm256_set1_pd(ray_t.min);
+            __m256d exit = _mm256_set1_pd(ray_t.max);
+            for (int a = 0; a < 3; ++a) {
+                const float* near_plane = node.bounds[r.negative[a] ? a + 3 : a] + g;
+                const float* far_plane = node.bounds[r.negative[a] ? a : a + 3] + g;
+                __m256d origin = _mm256_set1_pd(r.origin[a]);
+                __m256d inv_dir = _mm256_set1_pd(r.inv_dir[a]);
+                __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm_load_ps(near_plane)), origin), inv_dir);
+                __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm_load_ps(far_plane)), origin), inv_dir);
+                entry = _mm256_max_pd(t0, entry); // Returns `entry` if t0 is NaN
+                exit = _mm256_min_pd(t1, exit);
+            }
+            _mm256_storeu_pd(t_near + g, entry);
+            mask |= static_cast<uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(entry, exit, _CMP_LT_OQ))) << g;
+        }
+#elif defined(RT_PACKET_SSE2)
+        for (int g = 0; g < N; g += 2) {
+            __m128d entry = _mm_set1_pd(ray_t.min);
+            __m128d exit = _mm_set1_pd(ray_t.max);
+            for (int a = 0; a < 3; ++a) {
+                const float* near_plane = node.bounds[r.negative[a] ? a + 3 : a] + g;
+                const float* far_plane = node.bounds[r.negative[a] ? a : a + 3] + g;
+                __m128d origin = _mm_set1_pd(r.origin[a]);
+                __m128d inv_dir = _mm_set1_pd(r.inv_dir[a]);
+                __m128d near_d = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(near_plane))));
+                __m128d far_d = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(far_plane))));
+                __m128d t0 = _mm_mul_pd(_mm_sub_pd(near_d, origin), inv_dir);
+                __m128d t1 = _mm_mul_pd(_mm_sub_pd(far_d, origin), inv_dir);
+                entry = _mm_max_pd(t0, entry); // Returns `entry` if t0 is NaN
+                exit = _mm_min_pd(t1, exit);
+            }
+            _mm_storeu_pd(t_near + g, entry);
+            mask |= static_cast<uint32_t>(_mm_movemask_pd(_mm_cmplt_pd(entry, exit))) << g;
+        }
+#else
+        for (int i = 0; i < N; ++i) {
+            double entry = ray_t.min, exit = ray_t.max;
+            for (int a = 0; a < 3; ++a) {
+                double t0 = (node.bounds[r.negative[a] ? a + 3 : a][i] - r.origin[a]) * r.inv_dir[a];
+                double t1 = (node.bounds[r.negative[a] ? a : a + 3][i] - r.origin[a]) * r.inv_dir[a];
+                if (t0 > entry) entry = t0;
+                if (t1 < exit) exit = t1;
+            }
+            t_near[i] = entry;
+            if (entry < exit)
+                mask |= 1u << i;
+        }
+#endif
+        return mask;
+    }
+};
+
+#endif // WIDE_BVH_H